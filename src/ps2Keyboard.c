@@ -37,16 +37,31 @@
 #include <avr/common.h>
 #include <avr/interrupt.h>
 #include <util/delay.h>
+#include <util/parity.h>
 
 #include "ps2Keyboard.h"
 #include "ps2scanCodes.h"
+#include "ps2set1Codes.h"
 
 volatile int toggle = 0;
 
 enum keyReleaseStates {no_release, release};
 
+enum hotplugStates {hotplug_idle, hotplug_leds, hotplug_typematic, hotplug_notify};
+
+struct s_ps2subscriber
+{
+  t_PS2userRecvCallback callback;
+  uint8_t filter;
+  uint8_t low;
+  uint8_t high;
+};
+
 struct s_ps2keyboard
 {
+  //must stay the first member, the header inline accessors depend on it.
+  struct s_ps2keyboardSnapshot snapshot;
+
   union
   {
     struct
@@ -64,8 +79,9 @@ struct s_ps2keyboard
   {
     struct
     {
-      uint8_t rate:4;
-      uint8_t delay:4;
+      uint8_t rate:5;
+      uint8_t delay:2;
+      uint8_t nothing:1;
     } param;
 
     uint8_t packet;
@@ -78,16 +94,93 @@ struct s_ps2keyboard
   volatile uint8_t keybreak:1;
   volatile uint8_t idRecv:1;
 
+  //own bytes, the irq writes set1Break while the main loop sets typematicSet.
+  volatile uint8_t typematicSet;
+  volatile uint8_t set1Break;
+
   uint16_t id;
 
+  //ID byte getID expects next
+  volatile uint8_t idShift;
+
+  volatile uint8_t modifiers;
+
   volatile enum keyReleaseStates keyReleaseState;
+
+  //index into the scan code table of the last decoded key
+  volatile uint8_t lastIndex;
+
+  struct s_ps2stream *p_stream;
+
+  //scan code assembly buffer, cleared on hot plug
+  uint64_t scanBuffer;
+  int scanShift;
+
+  volatile enum hotplugStates hotplugState;
+
+  t_PS2hotplugCallback hotplugCallback;
+
+  t_PS2set1Callback set1Callback;
+
+  //bit n set means subscribers[n] is in use
+  volatile uint8_t subscriberMask;
+
+  struct s_ps2subscriber subscribers[PS2_MAX_SUBSCRIBERS];
+
+  //non NULL selects raw mode, decoding is skipped
+  struct s_ps2rawBuffer *p_raw;
+
+  //free running timer the timeout waits are measured against
+  volatile uint16_t *p_timer;
+
+  uint16_t lastWaitTicks;
+  uint16_t maxWaitTicks;
+
+  //non NULL enables line assembly into the user buffer
+  char *p_line;
+  uint8_t lineSize;
+  uint8_t lineLength;
+
+  t_PS2lineCallback lineCallback;
 };
 
 //helper functions
+//setup instance, port and pin change irq, returns 0 on invalid arguments.
+uint8_t setupPS2keyboard(struct s_ps2 *p_ps2keyboard, t_PS2userRecvCallback PS2recvCallback, void (*setPS2_PORT_Device)(struct s_ps2 *p_device), volatile uint8_t *p_port, uint8_t clkPin, uint8_t dataPin);
+//send changed LEDs or the next hot plug replay step, data line must be idle.
+void applyPS2leds(struct s_ps2 *p_ps2keyboard);
+//send a command and wait for its ACK and a callback state, resending on request, bounded by the timeout.
+enum ps2Status sendPS2commandTimeout(struct s_ps2 *p_ps2keyboard, uint8_t command, uint8_t state, uint16_t timeout);
+//route the answer to checkKeyboardResponse and send without the PS2_BASE ACK wait.
+void startPS2command(struct s_ps2 *p_ps2keyboard, uint8_t command);
+//wait for the data line to go idle, bounded by the timeout.
+enum ps2Status waitForDataIdleTimeout(struct s_ps2 *p_ps2keyboard, uint16_t timeout);
+//store the duration of the last wait.
+void recordPS2wait(struct s_ps2 *p_ps2keyboard, uint16_t ticks);
+//on a failed wait hand the receive path back to extractData, returns status.
+enum ps2Status endPS2commandTimeout(struct s_ps2 *p_ps2keyboard, enum ps2Status status);
+//add the last decoded key to the line buffer, returns 1 if the key was consumed.
+uint8_t assemblePS2line(struct s_ps2 *p_ps2keyboard);
 //convert scancode to define from scancodes header.
 uint8_t convertToDefine(struct s_ps2 *p_ps2keyboard, uint8_t ps2data);
 //set internal LED tracking and send LED state to keyboard.
 void setPS2leds(struct s_ps2 *p_ps2keyboard, uint8_t caps, uint8_t num, uint8_t scroll);
+//pack the last decoded key into the stream transmit queue.
+void pushPS2stream(struct s_ps2 *p_ps2keyboard);
+//clear decoder state after an unsolicited BAT and start the replay of cached settings.
+void resetPS2decoder(struct s_ps2 *p_ps2keyboard);
+//run one step of the hot plug replay, returns 1 if a step was taken.
+uint8_t stepPS2hotplug(struct s_ps2 *p_ps2keyboard);
+//copy current driver state into the snapshot under the sequence counter.
+void publishPS2snapshot(struct s_ps2 *p_ps2keyboard);
+//convert a define to its modifier state bit, 0 if it is not a modifier.
+uint8_t defineToModifier(uint8_t definePS2data);
+//translate a set 2 byte to set 1 and hand it to the set 1 callback.
+void translatePS2set1(struct s_ps2 *p_ps2keyboard, uint8_t ps2data);
+//call every subscriber whose filter matches the event.
+void dispatchPS2subscribers(struct s_ps2 *p_ps2keyboard, uint8_t definePS2data, uint8_t eventBits);
+//store a received frame in the raw buffer.
+void capturePS2raw(struct s_ps2rawBuffer *p_raw, uint16_t ps2data);
 //callbacks
 //get the two byte id
 void getID(void *p_data, uint16_t ps2Data);
@@ -97,19 +190,48 @@ void checkKeyboardResponse(void *p_data, uint16_t ps2Data);
 void extractData(void *p_data, uint16_t ps2data);
 
 void initPS2keyboard(struct s_ps2 *p_ps2keyboard, t_PS2userRecvCallback PS2recvCallback, void (*setPS2_PORT_Device)(struct s_ps2 *p_device), volatile uint8_t *p_port, uint8_t clkPin, uint8_t dataPin)
+{
+  if(!setupPS2keyboard(p_ps2keyboard, PS2recvCallback, setPS2_PORT_Device, p_port, clkPin, dataPin)) return;
+
+  //initialize keyboard using PC init method
+  resetPS2keyboard(p_ps2keyboard);
+
+  setPS2leds(p_ps2keyboard, 0, 0, 0);
+}
+
+enum ps2Status initPS2keyboardTimeout(struct s_ps2 *p_ps2keyboard, t_PS2userRecvCallback PS2recvCallback, void (*setPS2_PORT_Device)(struct s_ps2 *p_device), volatile uint8_t *p_port, uint8_t clkPin, uint8_t dataPin, volatile uint16_t *p_timer, uint16_t timeout)
+{
+  enum ps2Status status = ps2_ok;
+
+  if(p_timer == NULL) return ps2_invalid;
+
+  if(!setupPS2keyboard(p_ps2keyboard, PS2recvCallback, setPS2_PORT_Device, p_port, clkPin, dataPin)) return ps2_invalid;
+
+  setPS2timeoutTimer(p_ps2keyboard, p_timer);
+
+  status = resetPS2keyboardTimeout(p_ps2keyboard, timeout);
+
+  if(status != ps2_ok) return status;
+
+  setPS2leds(p_ps2keyboard, 0, 0, 0);
+
+  return ps2_ok;
+}
+
+uint8_t setupPS2keyboard(struct s_ps2 *p_ps2keyboard, t_PS2userRecvCallback PS2recvCallback, void (*setPS2_PORT_Device)(struct s_ps2 *p_device), volatile uint8_t *p_port, uint8_t clkPin, uint8_t dataPin)
 {
   uint8_t tmpSREG = 0;
 
-  tmpSREG = SREG;
-  cli();
+  if(p_ps2keyboard == NULL) return 0;
 
-  if(p_ps2keyboard == NULL) return;
+  if(p_port == NULL) return 0;
 
-  if(p_port == NULL) return;
+  if(PS2recvCallback == NULL) return 0;
 
-  if(PS2recvCallback == NULL) return;
+  if(setPS2_PORT_Device == NULL) return 0;
 
-  if(setPS2_PORT_Device == NULL) return;
+  tmpSREG = SREG;
+  cli();
 
   memset(p_ps2keyboard, 0, sizeof(struct s_ps2));
 
@@ -156,10 +278,7 @@ void initPS2keyboard(struct s_ps2 *p_ps2keyboard, t_PS2userRecvCallback PS2recvC
 
   sei();
 
-  //initialize keyboard using PC init method
-  resetPS2keyboard(p_ps2keyboard);
-
-  setPS2leds(p_ps2keyboard, 0, 0, 0);
+  return 1;
 }
 
 char PS2defineToChar(struct s_ps2 *p_ps2keyboard, uint8_t ps2data)
@@ -198,6 +317,26 @@ void updatePS2leds(struct s_ps2 *p_ps2keyboard)
 {
   waitForDataIdle(p_ps2keyboard);
 
+  applyPS2leds(p_ps2keyboard);
+}
+
+enum ps2Status updatePS2ledsTimeout(struct s_ps2 *p_ps2keyboard, uint16_t timeout)
+{
+  enum ps2Status status = ps2_ok;
+
+  status = waitForDataIdleTimeout(p_ps2keyboard, timeout);
+
+  if(status != ps2_ok) return status;
+
+  applyPS2leds(p_ps2keyboard);
+
+  return ps2_ok;
+}
+
+void applyPS2leds(struct s_ps2 *p_ps2keyboard)
+{
+  if(stepPS2hotplug(p_ps2keyboard)) return;
+
   if(((struct s_ps2keyboard *)(p_ps2keyboard->p_device))->prevLEDS.packet != ((struct s_ps2keyboard *)(p_ps2keyboard->p_device))->leds.packet)
   {
     setPS2leds(p_ps2keyboard, getPS2capsLockState(p_ps2keyboard), getPS2numLockState(p_ps2keyboard), getPS2scrollLockState(p_ps2keyboard));
@@ -243,6 +382,13 @@ void resetPS2keyboard(struct s_ps2 *p_ps2keyboard)
   waitForDevReady(p_ps2keyboard);
 }
 
+enum ps2Status resetPS2keyboardTimeout(struct s_ps2 *p_ps2keyboard, uint16_t timeout)
+{
+  if(((struct s_ps2keyboard *)(p_ps2keyboard->p_device))->p_timer == NULL) return ps2_invalid;
+
+  return endPS2commandTimeout(p_ps2keyboard, sendPS2commandTimeout(p_ps2keyboard, CMD_RESET, ready_cmd, timeout));
+}
+
 void disablePS2keyboard(struct s_ps2 *p_ps2keyboard)
 {
   sendCommand(p_ps2keyboard, CMD_DISABLE);
@@ -265,6 +411,8 @@ void setPS2typmaticRateDelay(struct s_ps2 *p_ps2keyboard, uint8_t delay, uint8_t
 
   ((struct s_ps2keyboard *)(p_ps2keyboard->p_device))->typematic.param.delay = (delay <= MAX_DELAY ? delay : DEFAULT_DELAY);
 
+  ((struct s_ps2keyboard *)(p_ps2keyboard->p_device))->typematicSet = 1;
+
   sendCommand(p_ps2keyboard, CMD_SET_RATE);
 
   sendData(p_ps2keyboard, ((struct s_ps2keyboard *)(p_ps2keyboard->p_device))->typematic.packet);
@@ -273,48 +421,322 @@ void setPS2typmaticRateDelay(struct s_ps2 *p_ps2keyboard, uint8_t delay, uint8_t
 void sendPS2readIDcmd(struct s_ps2 *p_ps2keyboard)
 {
   ((struct s_ps2keyboard *)(p_ps2keyboard->p_device))->id = 0;
+  ((struct s_ps2keyboard *)(p_ps2keyboard->p_device))->idShift = 0;
+
+  publishPS2snapshot(p_ps2keyboard);
 
   sendCommand(p_ps2keyboard, CMD_READ_ID);
 
   waitForDevID(p_ps2keyboard);
 }
 
+enum ps2Status sendPS2readIDcmdTimeout(struct s_ps2 *p_ps2keyboard, uint16_t timeout)
+{
+  if(((struct s_ps2keyboard *)(p_ps2keyboard->p_device))->p_timer == NULL) return ps2_invalid;
+
+  ((struct s_ps2keyboard *)(p_ps2keyboard->p_device))->id = 0;
+  ((struct s_ps2keyboard *)(p_ps2keyboard->p_device))->idShift = 0;
+
+  publishPS2snapshot(p_ps2keyboard);
+
+  return endPS2commandTimeout(p_ps2keyboard, sendPS2commandTimeout(p_ps2keyboard, CMD_READ_ID, dev_id, timeout));
+}
+
+void setPS2timeoutTimer(struct s_ps2 *p_ps2keyboard, volatile uint16_t *p_timer)
+{
+  ((struct s_ps2keyboard *)(p_ps2keyboard->p_device))->p_timer = p_timer;
+}
+
+uint16_t getPS2lastWaitTicks(struct s_ps2 *p_ps2keyboard)
+{
+  return ((struct s_ps2keyboard *)(p_ps2keyboard->p_device))->lastWaitTicks;
+}
+
+uint16_t getPS2maxWaitTicks(struct s_ps2 *p_ps2keyboard)
+{
+  return ((struct s_ps2keyboard *)(p_ps2keyboard->p_device))->maxWaitTicks;
+}
+
+void initPS2stream(struct s_ps2 *p_ps2keyboard, struct s_ps2stream *p_stream, volatile uint16_t *p_ticks, void (*setPS2_USART_Stream)(struct s_ps2stream *p_stream))
+{
+  uint8_t tmpSREG = 0;
+
+  if(p_ps2keyboard == NULL) return;
+
+  if(p_stream == NULL) return;
+
+  if(setPS2_USART_Stream == NULL) return;
+
+  tmpSREG = SREG;
+  cli();
+
+  memset(p_stream, 0, sizeof(struct s_ps2stream));
+
+  p_stream->p_ticks = p_ticks;
+
+  p_stream->lastTick = (p_ticks != NULL ? *p_ticks : 0);
+
+  setPS2_USART_Stream(p_stream);
+
+  ((struct s_ps2keyboard *)(p_ps2keyboard->p_device))->p_stream = p_stream;
+
+  SREG = tmpSREG;
+}
+
+void drainPS2stream(struct s_ps2stream *p_stream)
+{
+  if(p_stream == NULL) return;
+
+  //drain buffer is empty, swap in the fill buffer or stop the irq.
+  if(p_stream->drainIndex >= p_stream->drainCount)
+  {
+    if(!p_stream->fillCount)
+    {
+      UCSR0B &= ~(1 << UDRIE0);
+      return;
+    }
+
+    p_stream->drainCount = p_stream->fillCount;
+    p_stream->drainIndex = 0;
+    p_stream->fillCount = 0;
+    p_stream->fillBuffer ^= 1;
+  }
+
+  UDR0 = p_stream->buffer[p_stream->fillBuffer ^ 1][p_stream->drainIndex++];
+}
+
+uint8_t getPS2streamOverflow(struct s_ps2stream *p_stream)
+{
+  if(p_stream == NULL) return 0;
+
+  return p_stream->overflow;
+}
+
+void readPS2snapshot(struct s_ps2 *p_ps2keyboard, struct s_ps2keyboardState *p_state)
+{
+  uint8_t sequence = 0;
+
+  volatile struct s_ps2keyboardSnapshot *p_snapshot = NULL;
+
+  if(p_ps2keyboard == NULL) return;
+
+  if(p_state == NULL) return;
+
+  p_snapshot = &((struct s_ps2keyboard *)(p_ps2keyboard->p_device))->snapshot;
+
+  //odd sequence is a write in progress, a changed sequence is a torn copy.
+  do
+  {
+    do
+    {
+      sequence = p_snapshot->sequence;
+    } while(sequence & 0x01);
+
+    *p_state = p_snapshot->state;
+
+  } while(sequence != p_snapshot->sequence);
+}
+
+void setPS2hotplugCallback(struct s_ps2 *p_ps2keyboard, t_PS2hotplugCallback PS2hotplugCallback)
+{
+  ((struct s_ps2keyboard *)(p_ps2keyboard->p_device))->hotplugCallback = PS2hotplugCallback;
+}
+
+int8_t subscribePS2keyboard(struct s_ps2 *p_ps2keyboard, t_PS2userRecvCallback PS2recvCallback, uint8_t filter, uint8_t low, uint8_t high)
+{
+  uint8_t tmpSREG = 0;
+  int8_t slot = 0;
+
+  struct s_ps2keyboard *p_keyboard = NULL;
+
+  if(p_ps2keyboard == NULL) return -1;
+
+  if(PS2recvCallback == NULL) return -1;
+
+  p_keyboard = (struct s_ps2keyboard *)(p_ps2keyboard->p_device);
+
+  tmpSREG = SREG;
+  cli();
+
+  for(slot = 0; slot < PS2_MAX_SUBSCRIBERS; slot++)
+  {
+    if(!(p_keyboard->subscriberMask & (1 << slot)))
+    {
+      p_keyboard->subscribers[slot].callback = PS2recvCallback;
+      p_keyboard->subscribers[slot].filter = filter;
+      p_keyboard->subscribers[slot].low = low;
+      p_keyboard->subscribers[slot].high = high;
+
+      p_keyboard->subscriberMask |= 1 << slot;
+
+      SREG = tmpSREG;
+
+      return slot;
+    }
+  }
+
+  SREG = tmpSREG;
+
+  return -1;
+}
+
+void unsubscribePS2keyboard(struct s_ps2 *p_ps2keyboard, int8_t slot)
+{
+  uint8_t tmpSREG = 0;
+
+  if(p_ps2keyboard == NULL) return;
+
+  if((slot < 0) || (slot >= PS2_MAX_SUBSCRIBERS)) return;
+
+  tmpSREG = SREG;
+  cli();
+
+  ((struct s_ps2keyboard *)(p_ps2keyboard->p_device))->subscriberMask &= ~(1 << slot);
+
+  SREG = tmpSREG;
+}
+
+void setPS2rawMode(struct s_ps2 *p_ps2keyboard, struct s_ps2rawBuffer *p_rawBuffer, uint8_t *p_data, uint8_t *p_flags, uint8_t size)
+{
+  uint8_t tmpSREG = 0;
+
+  struct s_ps2keyboard *p_keyboard = NULL;
+
+  if(p_ps2keyboard == NULL) return;
+
+  if(p_rawBuffer != NULL)
+  {
+    if(p_data == NULL) return;
+
+    //size must be a power of two for the index mask.
+    if(!size || (size & (size - 1))) return;
+  }
+
+  p_keyboard = (struct s_ps2keyboard *)(p_ps2keyboard->p_device);
+
+  tmpSREG = SREG;
+  cli();
+
+  //the buffer may be the active one, reset it with the irq held off.
+  if(p_rawBuffer != NULL)
+  {
+    memset(p_rawBuffer, 0, sizeof(struct s_ps2rawBuffer));
+
+    p_rawBuffer->p_data = p_data;
+    p_rawBuffer->p_flags = p_flags;
+    p_rawBuffer->mask = size - 1;
+  }
+
+  //drop any partial scan code, it is meaningless across a mode change.
+  p_keyboard->scanBuffer = 0;
+  p_keyboard->scanShift = 0;
+
+  p_keyboard->p_raw = p_rawBuffer;
+
+  SREG = tmpSREG;
+}
+
+uint8_t readPS2raw(struct s_ps2rawBuffer *p_rawBuffer, uint8_t *p_data, uint8_t *p_flags, uint8_t length)
+{
+  uint8_t count = 0;
+  uint8_t tail = 0;
+
+  if(p_rawBuffer == NULL) return 0;
+
+  if(p_data == NULL) return 0;
+
+  tail = p_rawBuffer->tail;
+
+  for(count = 0; (count < length) && (tail != p_rawBuffer->head); count++)
+  {
+    p_data[count] = p_rawBuffer->p_data[tail];
+
+    if((p_flags != NULL) && (p_rawBuffer->p_flags != NULL)) p_flags[count] = p_rawBuffer->p_flags[tail];
+
+    tail = (tail + 1) & p_rawBuffer->mask;
+  }
+
+  p_rawBuffer->tail = tail;
+
+  return count;
+}
+
+void setPS2lineMode(struct s_ps2 *p_ps2keyboard, char *p_buffer, uint8_t size, t_PS2lineCallback PS2lineCallback)
+{
+  uint8_t tmpSREG = 0;
+
+  struct s_ps2keyboard *p_keyboard = NULL;
+
+  if(p_ps2keyboard == NULL) return;
+
+  //need room for at least one character and the terminator.
+  if((p_buffer != NULL) && ((size < 2) || (PS2lineCallback == NULL))) return;
+
+  p_keyboard = (struct s_ps2keyboard *)(p_ps2keyboard->p_device);
+
+  tmpSREG = SREG;
+  cli();
+
+  p_keyboard->lineSize = size;
+  p_keyboard->lineLength = 0;
+  p_keyboard->lineCallback = PS2lineCallback;
+  p_keyboard->p_line = p_buffer;
+
+  SREG = tmpSREG;
+}
+
+void setPS2set1Translation(struct s_ps2 *p_ps2keyboard, t_PS2set1Callback PS2set1Callback)
+{
+  uint8_t tmpSREG = 0;
+
+  tmpSREG = SREG;
+  cli();
+
+  ((struct s_ps2keyboard *)(p_ps2keyboard->p_device))->set1Break = 0;
+
+  ((struct s_ps2keyboard *)(p_ps2keyboard->p_device))->set1Callback = PS2set1Callback;
+
+  SREG = tmpSREG;
+}
+
 //helper functions
 uint8_t convertToDefine(struct s_ps2 *p_ps2keyboard, uint8_t ps2data)
 {
   int index = 0;
-  static int shift = 0;
-  static uint64_t buffer = 0;
+  struct s_ps2keyboard *p_keyboard = (struct s_ps2keyboard *)(p_ps2keyboard->p_device);
 
-  buffer |= (uint64_t)(ps2data << shift);
+  p_keyboard->scanBuffer |= ((uint64_t)ps2data << p_keyboard->scanShift);
 
   for(index = 0; e_set2scanCodes[index].defineCode != 0; index++)
   {
-    if(e_set2scanCodes[index].keyCode == buffer)
+    if(e_set2scanCodes[index].keyCode == p_keyboard->scanBuffer)
     {
-      buffer = 0;
-      shift = 0;
+      p_keyboard->scanBuffer = 0;
+      p_keyboard->scanShift = 0;
       ((struct s_ps2keyboard *)(p_ps2keyboard->p_device))->keyReleaseState = no_release;
+      ((struct s_ps2keyboard *)(p_ps2keyboard->p_device))->lastIndex = index;
       return e_set2scanCodes[index].defineCode;
     }
 
-    if(e_set2scanCodes[index].breakCode == buffer)
+    if(e_set2scanCodes[index].breakCode == p_keyboard->scanBuffer)
     {
-      buffer = 0;
-      shift = 0;
+      p_keyboard->scanBuffer = 0;
+      p_keyboard->scanShift = 0;
       ((struct s_ps2keyboard *)(p_ps2keyboard->p_device))->keyReleaseState = release;
+      ((struct s_ps2keyboard *)(p_ps2keyboard->p_device))->lastIndex = index;
       return e_set2scanCodes[index].defineCode;
     }
   }
 
   //shift by a byte for each miss, up to the total number of bytes in a 64 bit int
-  shift += sizeof(uint8_t)*8;
-  shift %= sizeof(uint64_t)*8;
+  p_keyboard->scanShift += sizeof(uint8_t)*8;
+  p_keyboard->scanShift %= sizeof(uint64_t)*8;
 
   //we have wrapped around, reset buffer to 0. this is an error.
-  if(!shift)
+  if(!p_keyboard->scanShift)
   {
-    buffer = 0;
+    p_keyboard->scanBuffer = 0;
+    p_keyboard->snapshot.state.lostEventCount++;
   }
 
   ((struct s_ps2keyboard *)(p_ps2keyboard->p_device))->keyReleaseState = no_release;
@@ -331,32 +753,455 @@ void setPS2leds(struct s_ps2 *p_ps2keyboard, uint8_t caps, uint8_t num, uint8_t
 
   ((struct s_ps2keyboard *)(p_ps2keyboard->p_device))->leds.bit.scroll = scroll & 0x01;
 
+  publishPS2snapshot(p_ps2keyboard);
+
   sendCommand_noack(p_ps2keyboard, CMD_SET_LED);
 
   sendData(p_ps2keyboard, ((struct s_ps2keyboard *)(p_ps2keyboard->p_device))->leds.packet);
 }
 
+enum ps2Status sendPS2commandTimeout(struct s_ps2 *p_ps2keyboard, uint8_t command, uint8_t state, uint16_t timeout)
+{
+  uint8_t resends = 0;
+  uint16_t start = 0;
+  uint16_t elapsed = 0;
+  enum callbackStates callbackState = waiting;
+
+  volatile uint16_t *p_timer = ((struct s_ps2keyboard *)(p_ps2keyboard->p_device))->p_timer;
+
+  //time the ACK too, sendCommand would spin on it with no keyboard.
+  start = *p_timer;
+
+  startPS2command(p_ps2keyboard, command);
+
+  for(;;)
+  {
+    //state before time, an answer seen is never recorded as quicker than it was.
+    callbackState = p_ps2keyboard->callbackState;
+
+    elapsed = *p_timer - start;
+
+    if(callbackState == state)
+    {
+      recordPS2wait(p_ps2keyboard, elapsed);
+      return ps2_ok;
+    }
+
+    if(callbackState == no_cmd)
+    {
+      recordPS2wait(p_ps2keyboard, elapsed);
+      return ps2_nak;
+    }
+
+    if(callbackState == resend_cmd)
+    {
+      if(++resends > PS2_MAX_RESENDS)
+      {
+        recordPS2wait(p_ps2keyboard, elapsed);
+        return ps2_resend_exhausted;
+      }
+
+      startPS2command(p_ps2keyboard, command);
+    }
+
+    if(elapsed >= timeout)
+    {
+      recordPS2wait(p_ps2keyboard, elapsed);
+      return ps2_timeout;
+    }
+  }
+}
+
+void startPS2command(struct s_ps2 *p_ps2keyboard, uint8_t command)
+{
+  uint8_t tmpSREG = 0;
+
+  //ready for the answer before the first bit goes out.
+  tmpSREG = SREG;
+  cli();
+
+  p_ps2keyboard->lastCMD = command;
+  p_ps2keyboard->callbackState = waiting;
+  p_ps2keyboard->recvCallback = &checkKeyboardResponse;
+
+  SREG = tmpSREG;
+
+  sendCommand_noack(p_ps2keyboard, command);
+}
+
+enum ps2Status waitForDataIdleTimeout(struct s_ps2 *p_ps2keyboard, uint16_t timeout)
+{
+  uint16_t start = 0;
+  uint16_t elapsed = 0;
+  enum dataStates dataState = busy;
+
+  volatile uint16_t *p_timer = ((struct s_ps2keyboard *)(p_ps2keyboard->p_device))->p_timer;
+
+  if(p_timer == NULL) return ps2_invalid;
+
+  start = *p_timer;
+
+  do
+  {
+    dataState = p_ps2keyboard->dataState;
+
+    elapsed = *p_timer - start;
+
+    if(dataState == idle)
+    {
+      recordPS2wait(p_ps2keyboard, elapsed);
+      return ps2_ok;
+    }
+  } while(elapsed < timeout);
+
+  recordPS2wait(p_ps2keyboard, elapsed);
+
+  return ps2_timeout;
+}
+
+enum ps2Status endPS2commandTimeout(struct s_ps2 *p_ps2keyboard, enum ps2Status status)
+{
+  uint8_t tmpSREG = 0;
+
+  if(status == ps2_ok) return status;
+
+  //a late or missing response must not leave keys going to getID or checkKeyboardResponse.
+  tmpSREG = SREG;
+  cli();
+
+  p_ps2keyboard->recvCallback = &extractData;
+
+  ((struct s_ps2keyboard *)(p_ps2keyboard->p_device))->idShift = 0;
+
+  SREG = tmpSREG;
+
+  return status;
+}
+
+void recordPS2wait(struct s_ps2 *p_ps2keyboard, uint16_t ticks)
+{
+  ((struct s_ps2keyboard *)(p_ps2keyboard->p_device))->lastWaitTicks = ticks;
+
+  if(ticks > ((struct s_ps2keyboard *)(p_ps2keyboard->p_device))->maxWaitTicks)
+  {
+    ((struct s_ps2keyboard *)(p_ps2keyboard->p_device))->maxWaitTicks = ticks;
+  }
+}
+
+void resetPS2decoder(struct s_ps2 *p_ps2keyboard)
+{
+  struct s_ps2keyboard *p_keyboard = (struct s_ps2keyboard *)(p_ps2keyboard->p_device);
+
+  p_keyboard->scanBuffer = 0;
+  p_keyboard->scanShift = 0;
+  p_keyboard->set1Break = 0;
+  p_keyboard->keyReleaseState = no_release;
+  p_keyboard->prevCapRelease = release;
+  p_keyboard->prevNumRelease = release;
+  p_keyboard->prevScrollRelease = release;
+
+  //id belongs to the old keyboard, the new one may differ.
+  p_keyboard->id = 0;
+  p_keyboard->modifiers = 0;
+
+  p_keyboard->hotplugState = hotplug_leds;
+
+  p_keyboard->snapshot.state.hotplugCount++;
+
+  publishPS2snapshot(p_ps2keyboard);
+}
+
+void publishPS2snapshot(struct s_ps2 *p_ps2keyboard)
+{
+  uint8_t tmpSREG = 0;
+
+  struct s_ps2keyboard *p_keyboard = (struct s_ps2keyboard *)(p_ps2keyboard->p_device);
+
+  //main loop writers must not be split by the irq writer.
+  tmpSREG = SREG;
+  cli();
+
+  p_keyboard->snapshot.sequence++;
+
+  p_keyboard->snapshot.state.leds = p_keyboard->leds.packet;
+  p_keyboard->snapshot.state.modifiers = p_keyboard->modifiers;
+  p_keyboard->snapshot.state.released = (p_keyboard->keyReleaseState == release);
+  p_keyboard->snapshot.state.id = p_keyboard->id;
+
+  p_keyboard->snapshot.sequence++;
+
+  SREG = tmpSREG;
+}
+
+uint8_t defineToModifier(uint8_t definePS2data)
+{
+  switch(definePS2data)
+  {
+    case KEYCODE_LSHIFT:
+      return MOD_LSHIFT;
+    case KEYCODE_RSHIFT:
+      return MOD_RSHIFT;
+    case KEYCODE_LCTRL:
+      return MOD_LCTRL;
+    case KEYCODE_RCTRL:
+      return MOD_RCTRL;
+    case KEYCODE_LALT:
+      return MOD_LALT;
+    case KEYCODE_RALT:
+      return MOD_RALT;
+    case KEYCODE_LGUI:
+      return MOD_LGUI;
+    case KEYCODE_RGUI:
+      return MOD_RGUI;
+    default:
+      break;
+  }
+
+  return 0;
+}
+
+uint8_t stepPS2hotplug(struct s_ps2 *p_ps2keyboard)
+{
+  uint8_t tmpSREG = 0;
+  enum hotplugStates state = hotplug_idle;
+
+  struct s_ps2keyboard *p_keyboard = (struct s_ps2keyboard *)(p_ps2keyboard->p_device);
+
+  //advance before sending so a BAT during the send restarts the replay.
+  tmpSREG = SREG;
+  cli();
+
+  state = p_keyboard->hotplugState;
+
+  switch(state)
+  {
+    case hotplug_leds:
+      p_keyboard->hotplugState = (p_keyboard->typematicSet ? hotplug_typematic : hotplug_notify);
+      break;
+    case hotplug_typematic:
+      p_keyboard->hotplugState = hotplug_notify;
+      break;
+    case hotplug_notify:
+      p_keyboard->hotplugState = hotplug_idle;
+      break;
+    default:
+      break;
+  }
+
+  SREG = tmpSREG;
+
+  switch(state)
+  {
+    case hotplug_leds:
+      setPS2leds(p_ps2keyboard, getPS2capsLockState(p_ps2keyboard), getPS2numLockState(p_ps2keyboard), getPS2scrollLockState(p_ps2keyboard));
+      p_keyboard->prevLEDS.packet = p_keyboard->leds.packet;
+      return 1;
+    case hotplug_typematic:
+      sendCommand(p_ps2keyboard, CMD_SET_RATE);
+      sendData(p_ps2keyboard, p_keyboard->typematic.packet);
+      return 1;
+    case hotplug_notify:
+      if(p_keyboard->hotplugCallback != NULL) p_keyboard->hotplugCallback();
+      return 1;
+    default:
+      break;
+  }
+
+  return 0;
+}
+
+void translatePS2set1(struct s_ps2 *p_ps2keyboard, uint8_t ps2data)
+{
+  struct s_ps2keyboard *p_keyboard = (struct s_ps2keyboard *)(p_ps2keyboard->p_device);
+
+  //set 1 has no break prefix, it sets bit 7 of the following code.
+  if(ps2data == SET2_BREAK_PREFIX)
+  {
+    p_keyboard->set1Break = 1;
+    return;
+  }
+
+  if(ps2data < SET1_TABLE_SIZE)
+  {
+    ps2data = pgm_read_byte(&e_set2toSet1[ps2data]) | (p_keyboard->set1Break ? SET1_BREAK_BIT : 0);
+  }
+
+  p_keyboard->set1Break = 0;
+
+  p_keyboard->set1Callback(ps2data);
+}
+
+void capturePS2raw(struct s_ps2rawBuffer *p_raw, uint16_t ps2data)
+{
+  uint8_t head = 0;
+  uint8_t rawPS2data = 0;
+  uint8_t flags = 0;
+
+  head = p_raw->head;
+
+  //full, keep the oldest bytes so the consumer sees a clean gap.
+  if(((head + 1) & p_raw->mask) == p_raw->tail)
+  {
+    if(p_raw->dropped < 0xFF) p_raw->dropped++;
+    return;
+  }
+
+  rawPS2data = convertToRaw(ps2data);
+
+  p_raw->p_data[head] = rawPS2data;
+
+  if(p_raw->p_flags != NULL)
+  {
+    //odd parity, parity bit plus data must have an odd number of ones.
+    if(parity_even_bit(rawPS2data) == ((ps2data >> FRAME_PARITY_BIT) & 0x01)) flags |= RAW_PARITY_ERROR;
+
+    if((ps2data & (1 << FRAME_START_BIT)) || !(ps2data & (1 << FRAME_STOP_BIT))) flags |= RAW_FRAME_ERROR;
+
+    p_raw->p_flags[head] = flags;
+  }
+
+  p_raw->head = (head + 1) & p_raw->mask;
+}
+
+uint8_t assemblePS2line(struct s_ps2 *p_ps2keyboard)
+{
+  char ascii = 0;
+
+  struct s_ps2keyboard *p_keyboard = (struct s_ps2keyboard *)(p_ps2keyboard->p_device);
+
+  ascii = e_set2scanCodes[p_keyboard->lastIndex].ascii;
+
+  if(((ascii < ' ') || (ascii >= KEYCODE_DEL)) && (ascii != '\b') && (ascii != '\r') && (ascii != '\t')) return 0;
+
+  //releases of line keys are consumed too, they carry nothing for the line.
+  if(p_keyboard->keyReleaseState == release) return 1;
+
+  switch(ascii)
+  {
+    case '\b':
+      if(p_keyboard->lineLength) p_keyboard->lineLength--;
+      return 1;
+    case '\r':
+      break;
+    default:
+      if((ascii >= 'a') && (ascii <= 'z') && p_keyboard->leds.bit.cap) ascii -= 32;
+
+      p_keyboard->p_line[p_keyboard->lineLength++] = ascii;
+
+      if(p_keyboard->lineLength < p_keyboard->lineSize - 1) return 1;
+      break;
+  }
+
+  p_keyboard->p_line[p_keyboard->lineLength] = '\0';
+
+  p_keyboard->lineCallback(p_keyboard->p_line, p_keyboard->lineLength);
+
+  p_keyboard->lineLength = 0;
+
+  return 1;
+}
+
+void dispatchPS2subscribers(struct s_ps2 *p_ps2keyboard, uint8_t definePS2data, uint8_t eventBits)
+{
+  uint8_t mask = 0;
+  uint8_t slot = 0;
+
+  struct s_ps2subscriber *p_subscriber = NULL;
+
+  mask = ((struct s_ps2keyboard *)(p_ps2keyboard->p_device))->subscriberMask;
+
+  for(slot = 0; mask; slot++, mask >>= 1)
+  {
+    if(!(mask & 0x01)) continue;
+
+    p_subscriber = &((struct s_ps2keyboard *)(p_ps2keyboard->p_device))->subscribers[slot];
+
+    //need a direction and a class match, range wraps so low to high is one compare.
+    if(!(p_subscriber->filter & eventBits & FILTER_DIRECTION)) continue;
+
+    if(!(p_subscriber->filter & eventBits & FILTER_CLASS)) continue;
+
+    if((p_subscriber->filter & FILTER_RANGE) && ((uint8_t)(definePS2data - p_subscriber->low) > (uint8_t)(p_subscriber->high - p_subscriber->low))) continue;
+
+    p_subscriber->callback(definePS2data);
+  }
+}
+
+void pushPS2stream(struct s_ps2 *p_ps2keyboard)
+{
+  uint16_t tick = 0;
+  uint16_t delta = 0;
+  uint8_t flags = 0;
+  uint64_t keyCode = 0;
+
+  struct s_ps2stream *p_stream = ((struct s_ps2keyboard *)(p_ps2keyboard->p_device))->p_stream;
+
+  //fill half is full, drop the record instead of tearing it.
+  if(p_stream->fillCount + STREAM_RECORD_SIZE > PS2_STREAM_BUFFER_SIZE)
+  {
+    if(p_stream->overflow < 0xFF) p_stream->overflow++;
+    return;
+  }
+
+  keyCode = e_set2scanCodes[((struct s_ps2keyboard *)(p_ps2keyboard->p_device))->lastIndex].keyCode;
+
+  //E0 and E1 (pause) prefixed keys share make codes with plain keys.
+  if(((keyCode & 0xFF) == 0xE0) || ((keyCode & 0xFF) == 0xE1)) flags |= STREAM_EXTENDED_BIT;
+
+  //the make code is the last byte of the make sequence.
+  while(keyCode > 0xFF) keyCode >>= 8;
+
+  if(getPS2keyReleased(p_ps2keyboard)) flags |= STREAM_BREAK_BIT;
+
+  if(p_stream->p_ticks != NULL)
+  {
+    tick = *(p_stream->p_ticks);
+
+    //clamp the full 16 bit gap, an 8 bit difference would wrap long gaps to noise.
+    delta = tick - p_stream->lastTick;
+
+    flags |= (delta > STREAM_DELTA_MASK ? STREAM_DELTA_MASK : (uint8_t)delta);
+
+    p_stream->lastTick = tick;
+  }
+
+  p_stream->buffer[p_stream->fillBuffer][p_stream->fillCount++] = (uint8_t)keyCode;
+  p_stream->buffer[p_stream->fillBuffer][p_stream->fillCount++] = flags;
+
+  UCSR0B |= 1 << UDRIE0;
+}
+
 
 void getID(void *p_data, uint16_t ps2Data)
 {
-  static int shift = 0;
   uint8_t convData = 0;
 
   struct s_ps2 *p_ps2 = NULL;
+  struct s_ps2keyboard *p_keyboard = NULL;
 
   if(p_data == NULL) return;
 
   p_ps2 = (struct s_ps2 *)p_data;
 
+  p_keyboard = (struct s_ps2keyboard *)(p_ps2->p_device);
+
   convData = convertToRaw(ps2Data);
 
-  ((struct s_ps2keyboard *)(p_ps2->p_device))->id |= convData << (shift * 8);
+  p_keyboard->id |= (uint16_t)convData << (p_keyboard->idShift * 8);
+
+  p_keyboard->idShift++;
+
+  //both bytes are in, following bytes are key data again.
+  if(p_keyboard->idShift > 1)
+  {
+    p_ps2->recvCallback = &extractData;
 
-  shift++;
+    publishPS2snapshot(p_ps2);
+  }
 
-  p_ps2->callbackState = (shift > 1 ? dev_id : waiting);
+  p_ps2->callbackState = (p_keyboard->idShift > 1 ? dev_id : waiting);
 
-  shift %= 2;
+  p_keyboard->idShift %= 2;
 }
 
 void checkKeyboardResponse(void *p_data, uint16_t ps2Data)
@@ -379,9 +1224,11 @@ void checkKeyboardResponse(void *p_data, uint16_t ps2Data)
       p_ps2->callbackState = ready_cmd;
       break;
     case CMD_RESEND:
+      ((struct s_ps2keyboard *)(p_ps2->p_device))->snapshot.state.cmdResendCount++;
       p_ps2->callbackState = resend_cmd;
       break;
     case CMD_ACK:
+      ((struct s_ps2keyboard *)(p_ps2->p_device))->snapshot.state.cmdAckCount++;
       if(p_ps2->lastCMD == CMD_READ_ID)
         p_ps2->recvCallback = &getID;
       if(p_ps2->lastCMD == CMD_RESET)
@@ -389,15 +1236,21 @@ void checkKeyboardResponse(void *p_data, uint16_t ps2Data)
       p_ps2->callbackState = ack_cmd;
       break;
     default:
+      ((struct s_ps2keyboard *)(p_ps2->p_device))->snapshot.state.cmdErrorCount++;
       p_ps2->callbackState = no_cmd;
       break;
   }
+
+  publishPS2snapshot(p_ps2);
 }
 
 void extractData(void *p_data, uint16_t ps2data)
 {
   uint8_t rawPS2data = 0;
   uint8_t definePS2data = 0;
+  uint8_t modifierBit = 0;
+  uint8_t eventBits = 0;
+  char ascii = 0;
 
   struct s_ps2 *p_ps2 = NULL;
 
@@ -405,10 +1258,53 @@ void extractData(void *p_data, uint16_t ps2data)
 
   p_ps2 = (struct s_ps2 *)p_data;
 
+  if(((struct s_ps2keyboard *)(p_ps2->p_device))->p_raw != NULL)
+  {
+    capturePS2raw(((struct s_ps2keyboard *)(p_ps2->p_device))->p_raw, ps2data);
+    return;
+  }
+
   rawPS2data = convertToRaw(ps2data);
 
+  if(((struct s_ps2keyboard *)(p_ps2->p_device))->set1Callback != NULL)
+  {
+    translatePS2set1(p_ps2, rawPS2data);
+  }
+
+  //unsolicited BAT, keyboard was plugged back in.
+  if((rawPS2data == CMD_DEV_RDY) || (rawPS2data == RESP_BAT_FAIL))
+  {
+    resetPS2decoder(p_ps2);
+    return;
+  }
+
   definePS2data = convertToDefine(p_ps2, rawPS2data);
 
+  //count bytes dropped by a scan code wrap.
+  if(!definePS2data && !((struct s_ps2keyboard *)(p_ps2->p_device))->scanShift)
+  {
+    publishPS2snapshot(p_ps2);
+  }
+
+  if(definePS2data && (((struct s_ps2keyboard *)(p_ps2->p_device))->p_stream != NULL))
+  {
+    pushPS2stream(p_ps2);
+  }
+
+  modifierBit = defineToModifier(definePS2data);
+
+  if(modifierBit)
+  {
+    if(getPS2keyReleased(p_ps2))
+    {
+      ((struct s_ps2keyboard *)(p_ps2->p_device))->modifiers &= ~modifierBit;
+    }
+    else
+    {
+      ((struct s_ps2keyboard *)(p_ps2->p_device))->modifiers |= modifierBit;
+    }
+  }
+
   switch(definePS2data)
   {
     case KEYCODE_CAPS:
@@ -436,7 +1332,42 @@ void extractData(void *p_data, uint16_t ps2data)
       ((struct s_ps2keyboard *)(p_ps2->p_device))->prevScrollRelease = ((struct s_ps2keyboard *)(p_ps2->p_device))->keyReleaseState;
       break;
     default:
+      if(definePS2data && (((struct s_ps2keyboard *)(p_ps2->p_device))->p_line != NULL))
+      {
+        if(assemblePS2line(p_ps2)) break;
+      }
+
       p_ps2->userRecvCallback(definePS2data);
       break;
   }
+
+  if(definePS2data && ((struct s_ps2keyboard *)(p_ps2->p_device))->subscriberMask)
+  {
+    ascii = e_set2scanCodes[((struct s_ps2keyboard *)(p_ps2->p_device))->lastIndex].ascii;
+
+    eventBits = (getPS2keyReleased(p_ps2) ? FILTER_BREAK : FILTER_MAKE);
+
+    if(modifierBit)
+    {
+      eventBits |= FILTER_MODIFIER;
+    }
+    else if((ascii >= ' ') && (ascii < KEYCODE_DEL))
+    {
+      eventBits |= FILTER_PRINTABLE;
+    }
+    else
+    {
+      eventBits |= FILTER_OTHER;
+    }
+
+    dispatchPS2subscribers(p_ps2, definePS2data, eventBits);
+  }
+
+  if(definePS2data)
+  {
+    ((struct s_ps2keyboard *)(p_ps2->p_device))->snapshot.state.lastEvent = definePS2data;
+    ((struct s_ps2keyboard *)(p_ps2->p_device))->snapshot.state.eventCount++;
+
+    publishPS2snapshot(p_ps2);
+  }
 }
@@ -38,6 +38,109 @@
 #include "ps2base.h"
 #include "ps2keyboardDefines.h"
 
+//result of the timeout bounded commands.
+enum ps2Status {ps2_ok, ps2_timeout, ps2_nak, ps2_resend_exhausted, ps2_invalid};
+
+//resends allowed per timeout bounded command before giving up.
+#ifndef PS2_MAX_RESENDS
+#define PS2_MAX_RESENDS 3
+#endif
+
+//hot plug notification, called from updatePS2leds once cached settings are replayed.
+typedef void (*t_PS2hotplugCallback)(void);
+
+/**
+ * \brief Driver state as seen by the application, see readPS2snapshot.
+ */
+struct s_ps2keyboardState
+{
+  uint8_t leds;
+  uint8_t modifiers;
+  uint8_t lastEvent;
+  uint8_t released;
+  uint16_t id;
+  uint16_t eventCount;
+  uint8_t hotplugCount;
+  //responses seen by the command response handler
+  uint16_t cmdAckCount;
+  uint8_t cmdResendCount;
+  uint8_t cmdErrorCount;
+  //scan code assemblies thrown away after 8 bytes matched no table entry,
+  //garbled or unknown codes, not keys missed because of the typing rate.
+  uint8_t lostEventCount;
+};
+
+/**
+ * \brief State published by the irq, sequence is odd while a write is in progress.
+ */
+struct s_ps2keyboardSnapshot
+{
+  volatile uint8_t sequence;
+  volatile struct s_ps2keyboardState state;
+};
+
+//set 1 (XT) translated output, called from the keyboard irq once per set 1 byte.
+typedef void (*t_PS2set1Callback)(uint8_t set1Data);
+
+/**
+ * \brief Raw mode ring buffer of received bytes, see setPS2rawMode.
+ */
+struct s_ps2rawBuffer
+{
+  uint8_t *p_data;
+  uint8_t *p_flags;
+  uint8_t mask;
+
+  volatile uint8_t head;
+  volatile uint8_t tail;
+
+  volatile uint8_t dropped;
+};
+
+//number of subscriber slots, 8 at most.
+#ifndef PS2_MAX_SUBSCRIBERS
+#define PS2_MAX_SUBSCRIBERS 4
+#endif
+
+#if PS2_MAX_SUBSCRIBERS > 8
+#error "PS2_MAX_SUBSCRIBERS must be 8 or less, slots are tracked in an 8 bit mask"
+#endif
+
+//line mode completion, the line is only valid until the callback returns.
+typedef void (*t_PS2lineCallback)(char *p_line, uint8_t length);
+
+//size of each half of the stream double buffer in bytes.
+#ifndef PS2_STREAM_BUFFER_SIZE
+#define PS2_STREAM_BUFFER_SIZE 16
+#endif
+
+/**
+ * \brief Double buffered transmit queue for compact key event records.
+ *
+ * Each record is two bytes. The first is the set 2 make code of the key,
+ * the last byte of its make sequence (0x7C for print screen, 0x77 for pause).
+ * The second holds STREAM_BREAK_BIT, STREAM_EXTENDED_BIT for E0/E1 prefixed
+ * keys and, if a tick counter is given, the ticks since the previous record
+ * in STREAM_DELTA_MASK, saturating at 63. The unit is one tick of that
+ * counter. The difference is taken in 16 bits, so any gap from 63 up to
+ * 65535 ticks reads as 63.
+ * The keyboard irq fills one half while the USART irq drains the other.
+ */
+struct s_ps2stream
+{
+  uint8_t buffer[2][PS2_STREAM_BUFFER_SIZE];
+
+  volatile uint8_t fillBuffer;
+  volatile uint8_t fillCount;
+  volatile uint8_t drainIndex;
+  volatile uint8_t drainCount;
+
+  volatile uint16_t *p_ticks;
+  uint16_t lastTick;
+
+  volatile uint8_t overflow;
+};
+
 /**
  * \brief initialize PS2 keyboard
  *
@@ -50,6 +153,25 @@
  */
 void initPS2keyboard(struct s_ps2 *p_ps2keyboard, t_PS2userRecvCallback PS2recvCallback, void (*setPS2_PORT_Device)(struct s_ps2 *p_device), volatile uint8_t *p_port, uint8_t clkPin, uint8_t dataPin);
 
+/**
+ * \brief initialize PS2 keyboard, the reset is bounded by a timeout from
+ * the send through its ACK to the BAT, so it returns with no keyboard
+ * plugged in. The LED command and data sent after a good reset use the
+ * PS2_BASE sends and are not bounded.
+ *
+ * \param p_ps2keyboard struct containing keyboard instance information
+ * \param PS2recvCallback Callback to a user supplied function to parse keyboard data.
+ * \param setPS2_PORT_device A function pointer to a IRQ port data setter.
+ * \param p_port Gets the address of a port to be used for the clk and data pin.
+ * \param clkPin Define which pin used for the clock
+ * \param dataPin Define the pin used for data.
+ * \param p_timer free running 16 bit timer count register, such as TCNT1.
+ * \param timeout max timer ticks to wait for the keyboard to be ready.
+ *
+ * \return ps2_ok, ps2_timeout, ps2_nak, ps2_resend_exhausted or ps2_invalid.
+ */
+enum ps2Status initPS2keyboardTimeout(struct s_ps2 *p_ps2keyboard, t_PS2userRecvCallback PS2recvCallback, void (*setPS2_PORT_Device)(struct s_ps2 *p_device), volatile uint8_t *p_port, uint8_t clkPin, uint8_t dataPin, volatile uint16_t *p_timer, uint16_t timeout);
+
 /**
  * \brief Convert PS2 keyboard define representation
  * to a character.
@@ -63,7 +185,9 @@ char PS2defineToChar(struct s_ps2 *p_ps2keyboard, uint8_t ps2data);
 
 /**
  * \brief Updates LEDS on keyboard, must be called in for loop, can NOT
- * be called by the user callback, program will hang.
+ * be called by the user callback, program will hang. After a hot plug each
+ * call replays one cached setting (LEDs, typematic) and then raises the
+ * hot plug callback.
  *
  * \param p_ps2keyboard struct containing keyboard instance information
  */
@@ -173,4 +297,225 @@ void setPS2typmaticRateDelay(struct s_ps2 *p_ps2keyboard, uint8_t delay, uint8_t
  */
 void sendPS2readIDcmd(struct s_ps2 *p_ps2keyboard);
 
+/**
+ * \brief Attach a stream transmit queue to the keyboard, every decoded
+ * key is then packed into it and sent by the USART data register empty irq.
+ * USART baud rate and transmitter enable are left to the user.
+ *
+ * \param p_ps2keyboard struct containing keyboard instance information
+ * \param p_stream struct containing the stream queue, must stay valid.
+ * \param p_ticks free running 16 bit counter for delta time stamps, NULL sends a delta of 0.
+ *      For key gaps pick a slow tick, a count kept by a timer irq every 16 ms
+ *      spans 0 to 1 s, TCNT1 at clk/1024 and 16 MHz (64 us) spans 0 to 4 ms.
+ * \param setPS2_USART_Stream A function pointer to the USART IRQ stream setter.
+ */
+void initPS2stream(struct s_ps2 *p_ps2keyboard, struct s_ps2stream *p_stream, volatile uint16_t *p_ticks, void (*setPS2_USART_Stream)(struct s_ps2stream *p_stream));
+
+/**
+ * \brief Send the next stream byte, called by the USART data register empty irq.
+ *
+ * \param p_stream struct containing the stream queue.
+ */
+void drainPS2stream(struct s_ps2stream *p_stream);
+
+/**
+ * \brief Get number of records dropped because the stream queue was full.
+ *
+ * \param p_stream struct containing the stream queue.
+ *
+ * \return dropped record count, saturates at 255.
+ */
+uint8_t getPS2streamOverflow(struct s_ps2stream *p_stream);
+
+/**
+ * \brief Get a consistent copy of the driver state without disabling irqs.
+ *
+ * \param p_ps2keyboard struct containing keyboard instance information
+ * \param p_state struct the state is copied into.
+ */
+void readPS2snapshot(struct s_ps2 *p_ps2keyboard, struct s_ps2keyboardState *p_state);
+
+/**
+ * \brief Get LED state bits (LED_CAPS, LED_NUM, LED_SCROLL), single byte read.
+ *
+ * \param p_ps2keyboard struct containing keyboard instance information
+ *
+ * \return LED state bits.
+ */
+static inline uint8_t getPS2snapshotLEDs(struct s_ps2 *p_ps2keyboard)
+{
+  return ((volatile struct s_ps2keyboardSnapshot *)(p_ps2keyboard->p_device))->state.leds;
+}
+
+/**
+ * \brief Get modifier state bits (MOD_LSHIFT through MOD_RGUI), single byte read.
+ *
+ * \param p_ps2keyboard struct containing keyboard instance information
+ *
+ * \return modifier state bits.
+ */
+static inline uint8_t getPS2snapshotModifiers(struct s_ps2 *p_ps2keyboard)
+{
+  return ((volatile struct s_ps2keyboardSnapshot *)(p_ps2keyboard->p_device))->state.modifiers;
+}
+
+/**
+ * \brief Get the define of the last decoded key, single byte read.
+ *
+ * \param p_ps2keyboard struct containing keyboard instance information
+ *
+ * \return define from the scan code lookup table.
+ */
+static inline uint8_t getPS2snapshotLastEvent(struct s_ps2 *p_ps2keyboard)
+{
+  return ((volatile struct s_ps2keyboardSnapshot *)(p_ps2keyboard->p_device))->state.lastEvent;
+}
+
+/**
+ * \brief Set callback raised after a keyboard is plugged back in and its
+ * cached settings are replayed. The keyboard ID is cleared, call
+ * sendPS2readIDcmd from the callback if it is needed.
+ *
+ * \param p_ps2keyboard struct containing keyboard instance information
+ * \param PS2hotplugCallback user function called from updatePS2leds, NULL for none.
+ */
+void setPS2hotplugCallback(struct s_ps2 *p_ps2keyboard, t_PS2hotplugCallback PS2hotplugCallback);
+
+/**
+ * \brief Enable set 1 (XT) translation like an 8042 controller in translate
+ * mode. Every set 2 byte received is translated by a flash table, E0 and E1
+ * prefixes pass through and F0 becomes bit 7 of the next code. Decoding and
+ * the user callback are unaffected.
+ *
+ * \param p_ps2keyboard struct containing keyboard instance information
+ * \param PS2set1Callback user function given each set 1 byte, NULL disables translation.
+ */
+void setPS2set1Translation(struct s_ps2 *p_ps2keyboard, t_PS2set1Callback PS2set1Callback);
+
+/**
+ * \brief Add a subscriber called from the keyboard irq for decoded keys that
+ * match its filter. The callback given to initPS2keyboard is still called.
+ *
+ * \param p_ps2keyboard struct containing keyboard instance information
+ * \param PS2recvCallback user function given the define of the key.
+ * \param filter FILTER_ bits, at least one of FILTER_MAKE/FILTER_BREAK and
+ *      one of FILTER_MODIFIER/FILTER_PRINTABLE/FILTER_OTHER must match.
+ * \param low first define in range, only used with FILTER_RANGE.
+ * \param high last define in range, only used with FILTER_RANGE.
+ *
+ * \return subscriber slot, -1 if none are free.
+ */
+int8_t subscribePS2keyboard(struct s_ps2 *p_ps2keyboard, t_PS2userRecvCallback PS2recvCallback, uint8_t filter, uint8_t low, uint8_t high);
+
+/**
+ * \brief Remove a subscriber.
+ *
+ * \param p_ps2keyboard struct containing keyboard instance information
+ * \param slot subscriber slot returned by subscribePS2keyboard.
+ */
+void unsubscribePS2keyboard(struct s_ps2 *p_ps2keyboard, int8_t slot);
+
+/**
+ * \brief Select raw mode, received bytes are stored as is with no decoding,
+ * lock key handling, hot plug detection, translation, stream or callbacks.
+ * Call right after initPS2keyboard to start in raw mode, or at any time
+ * to switch.
+ *
+ * \param p_ps2keyboard struct containing keyboard instance information
+ * \param p_rawBuffer struct for the ring buffer state, NULL returns to decoded mode.
+ * \param p_data storage for received bytes.
+ * \param p_flags storage for RAW_ error flags per byte, NULL skips the checks.
+ * \param size number of bytes in p_data and p_flags, must be a power of two.
+ *      One entry is kept free to tell full from empty.
+ */
+void setPS2rawMode(struct s_ps2 *p_ps2keyboard, struct s_ps2rawBuffer *p_rawBuffer, uint8_t *p_data, uint8_t *p_flags, uint8_t size);
+
+/**
+ * \brief Read a batch of raw mode bytes.
+ *
+ * \param p_rawBuffer struct for the ring buffer state.
+ * \param p_data array the bytes are copied into.
+ * \param p_flags array the error flags are copied into, can be NULL.
+ * \param length max number of bytes to copy.
+ *
+ * \return number of bytes copied.
+ */
+uint8_t readPS2raw(struct s_ps2rawBuffer *p_rawBuffer, uint8_t *p_data, uint8_t *p_flags, uint8_t length);
+
+/**
+ * \brief Set the free running timer used by the timeout bounded commands,
+ * initPS2keyboardTimeout does this already.
+ *
+ * \param p_ps2keyboard struct containing keyboard instance information
+ * \param p_timer 16 bit timer count register, such as TCNT1.
+ */
+void setPS2timeoutTimer(struct s_ps2 *p_ps2keyboard, volatile uint16_t *p_timer);
+
+/**
+ * \brief Reset PS2 keyboard, the command is sent without the PS2_BASE ACK
+ * wait and the timeout bounds the ACK and the BAT. On failure key data goes
+ * to the decoder again.
+ *
+ * \param p_ps2keyboard struct containing keyboard instance information
+ * \param timeout max timer ticks from the send to the keyboard being ready.
+ *
+ * \return ps2_ok, ps2_timeout, ps2_nak, ps2_resend_exhausted or ps2_invalid with no timer.
+ */
+enum ps2Status resetPS2keyboardTimeout(struct s_ps2 *p_ps2keyboard, uint16_t timeout);
+
+/**
+ * \brief Send PS2 command to keyboard to read the ID, the command is sent
+ * without the PS2_BASE ACK wait and the timeout bounds the ACK and both ID
+ * bytes. On failure key data goes to the decoder again.
+ *
+ * \param p_ps2keyboard struct containing keyboard instance information
+ * \param timeout max timer ticks from the send to the second ID byte.
+ *
+ * \return ps2_ok, ps2_timeout, ps2_nak, ps2_resend_exhausted or ps2_invalid with no timer.
+ */
+enum ps2Status sendPS2readIDcmdTimeout(struct s_ps2 *p_ps2keyboard, uint16_t timeout);
+
+/**
+ * \brief Updates LEDS on keyboard like updatePS2leds. Only the wait for
+ * the data line to go idle is bounded by the timeout, the LED command and
+ * data sends that follow are not.
+ *
+ * \param p_ps2keyboard struct containing keyboard instance information
+ * \param timeout max timer ticks to wait for the data line to be idle.
+ *
+ * \return ps2_ok, ps2_timeout or ps2_invalid with no timer.
+ */
+enum ps2Status updatePS2ledsTimeout(struct s_ps2 *p_ps2keyboard, uint16_t timeout);
+
+/**
+ * \brief Get how long the last timeout bounded wait took.
+ *
+ * \param p_ps2keyboard struct containing keyboard instance information
+ *
+ * \return timer ticks.
+ */
+uint16_t getPS2lastWaitTicks(struct s_ps2 *p_ps2keyboard);
+
+/**
+ * \brief Get the longest timeout bounded wait seen.
+ *
+ * \param p_ps2keyboard struct containing keyboard instance information
+ *
+ * \return timer ticks.
+ */
+uint16_t getPS2maxWaitTicks(struct s_ps2 *p_ps2keyboard);
+
+/**
+ * \brief Enable line mode, printable keys, tab and backspace edit a line in
+ * place in the user buffer. Enter or a full buffer terminates the line
+ * and calls the line callback from the keyboard irq. Keys used by the line
+ * are not passed to the callback given to initPS2keyboard.
+ *
+ * \param p_ps2keyboard struct containing keyboard instance information
+ * \param p_buffer user buffer the line is built in, NULL disables line mode.
+ * \param size size of p_buffer including the null terminator, at least 2.
+ * \param PS2lineCallback user function given the finished line and its length.
+ */
+void setPS2lineMode(struct s_ps2 *p_ps2keyboard, char *p_buffer, uint8_t size, t_PS2lineCallback PS2lineCallback);
+
 #endif
@@ -0,0 +1,59 @@
+/*******************************************************************************
+ * @file    ps2USARTirq.h
+ * @author  Jay Convertino(electrobs@gmail.com)
+ * @date    2024.03.12
+ * @brief   ps2 keyboard stream USART irq
+ * @version 0.0.0
+ *
+ * @TODO
+ *  - Cleanup interface
+ *
+ * @license mit
+ *
+ * Copyright 2024 Johnathan Convertino
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ ******************************************************************************/
+
+#ifndef _ps2USARTirq
+#define _ps2USARTirq
+
+#include <stddef.h>
+#include <avr/interrupt.h>
+
+#include "ps2Keyboard.h"
+
+struct s_ps2stream *gp_USART_ps2stream = NULL;
+
+/**
+ * \brief Set the stream drained by the USART data register empty irq.
+ *
+ * \param p_stream struct containing the stream queue.
+ */
+void setPS2_USART_Stream(struct s_ps2stream *p_stream)
+{
+  gp_USART_ps2stream = p_stream;
+}
+
+ISR(USART_UDRE_vect)
+{
+  drainPS2stream(gp_USART_ps2stream);
+}
+
+#endif
@@ -44,6 +44,60 @@
 //keyboard commands
 #define CMD_SET_LED     0xED
 
+//keyboard responses
+#define RESP_BAT_FAIL   0xFC
+
+//set 1 translation
+#define SET2_BREAK_PREFIX 0xF0
+#define SET1_BREAK_BIT    0x80
+
+//stream record, set 2 make code then a flags byte
+#define STREAM_RECORD_SIZE  2
+#define STREAM_BREAK_BIT    0x80
+#define STREAM_EXTENDED_BIT 0x40
+#define STREAM_DELTA_MASK   0x3F
+
+//modifier state bits
+#define MOD_LSHIFT  0x01
+#define MOD_RSHIFT  0x02
+#define MOD_LCTRL   0x04
+#define MOD_RCTRL   0x08
+#define MOD_LALT    0x10
+#define MOD_RALT    0x20
+#define MOD_LGUI    0x40
+#define MOD_RGUI    0x80
+
+//led state bits
+#define LED_SCROLL  0x01
+#define LED_NUM     0x02
+#define LED_CAPS    0x04
+
+//subscriber filter bits, a subscriber needs a direction and a class match
+#define FILTER_MAKE       0x01
+#define FILTER_BREAK      0x02
+#define FILTER_MODIFIER   0x04
+#define FILTER_PRINTABLE  0x08
+#define FILTER_OTHER      0x10
+#define FILTER_RANGE      0x20
+#define FILTER_DIRECTION  (FILTER_MAKE | FILTER_BREAK)
+#define FILTER_CLASS      (FILTER_MODIFIER | FILTER_PRINTABLE | FILTER_OTHER)
+#define FILTER_ALL        (FILTER_DIRECTION | FILTER_CLASS)
+
+//raw frame bit positions as captured by PS2_BASE, start bit first
+#ifndef FRAME_START_BIT
+#define FRAME_START_BIT   0
+#endif
+#ifndef FRAME_PARITY_BIT
+#define FRAME_PARITY_BIT  9
+#endif
+#ifndef FRAME_STOP_BIT
+#define FRAME_STOP_BIT    10
+#endif
+
+//raw mode error flags
+#define RAW_PARITY_ERROR  0x01
+#define RAW_FRAME_ERROR   0x02
+
 //keyboard ID
 #define KEYBOARD_ID1    0xAB
 #define KEYBOARD_ID2    0x83
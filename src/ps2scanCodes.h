@@ -114,7 +114,7 @@ struct s_set2scanCodes e_set2scanCodes[]=
   {0, KEYCODE_F10, 0x0000000000000009, 0x00000000000009F0},
   {0, KEYCODE_F11, 0x0000000000000078, 0x00000000000078F0},
   {0, KEYCODE_F12, 0x0000000000000007, 0x00000000000007F0},
-  {0, KEYCODE_PRTSCR, 0x000000007CE012E0, 0x00007CF0E012F0E0},
+  {0, KEYCODE_PRTSCR, 0x000000007CE012E0, 0x000012F0E07CF0E0},
   {0, KEYCODE_SCROLL, 0x000000000000007E, 0x0000000000007EF0},
   {0, KEYCODE_PAUSE, 0x77F014F0E17714E1, 0x77F014F0E17714E1},
   {'[', '[', 0x0000000000000054, 0x00000000000054F0},
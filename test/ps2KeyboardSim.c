@@ -0,0 +1,401 @@
+/*******************************************************************************
+ * @file    ps2KeyboardSim.c
+ * @author  Jay Convertino(electrobs@gmail.com)
+ * @date    2024.03.12
+ * @brief   virtual PS2 keyboard and host model of PS2_BASE
+ * @version 0.0.0
+ *
+ * @TODO
+ *  - Cleanup interface
+ *
+ * @license mit
+ *
+ * Copyright 2024 Johnathan Convertino
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ ******************************************************************************/
+
+
+#include <stddef.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include <avr/io.h>
+
+#include "ps2KeyboardSim.h"
+
+volatile uint8_t simIO[0x100];
+volatile uint16_t simTimer = 0;
+
+struct s_ps2keyboardSim g_sim;
+
+//keyboard to host queue, due is the timer value the byte is sent at.
+static struct
+{
+  uint16_t frame;
+  uint16_t due;
+} gs_queue[SIM_QUEUE_SIZE];
+
+static uint16_t gs_head = 0;
+static uint16_t gs_tail = 0;
+static uint16_t gs_lastDue = 0;
+
+//timer value the driver irq is done with the last frame.
+static uint16_t gs_busyUntil = 0;
+
+static struct s_ps2 *gp_ps2 = NULL;
+
+static void (*gp_tickHook)(void) = NULL;
+
+//serializes irq context, the driver's cli() is a no op on the host.
+static pthread_mutex_t gs_irqLock = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_t gs_clockThread;
+static volatile uint8_t gs_clockRun = 0;
+
+//set 2 codes for simType.
+static const struct
+{
+  char ascii;
+  uint8_t code;
+} gs_asciiCodes[] =
+{
+  {'a', 0x1C}, {'b', 0x32}, {'c', 0x21}, {'d', 0x23}, {'e', 0x24}, {'f', 0x2B},
+  {'g', 0x34}, {'h', 0x33}, {'i', 0x43}, {'j', 0x3B}, {'k', 0x42}, {'l', 0x4B},
+  {'m', 0x3A}, {'n', 0x31}, {'o', 0x44}, {'p', 0x4D}, {'q', 0x15}, {'r', 0x2D},
+  {'s', 0x1B}, {'t', 0x2C}, {'u', 0x3C}, {'v', 0x2A}, {'w', 0x1D}, {'x', 0x22},
+  {'y', 0x35}, {'z', 0x1A}, {'0', 0x45}, {'1', 0x16}, {'2', 0x1E}, {'3', 0x26},
+  {'4', 0x25}, {'5', 0x2E}, {'6', 0x36}, {'7', 0x3D}, {'8', 0x3E}, {'9', 0x46},
+  {' ', 0x29}, {'\r', 0x5A}, {'\b', 0x66}, {'\0', 0x00}
+};
+
+//keyboard receives a host byte and answers through the response callback, returns 0 if nothing answered.
+static uint8_t hostByte(struct s_ps2 *p_ps2, uint8_t data);
+//hand a frame to the driver like the PS2_BASE irq.
+static void deliver(uint16_t frame);
+//PS2_BASE blocking wait model with resend handling.
+static void waitForState(struct s_ps2 *p_ps2, enum callbackStates state);
+static void *clockThread(void *p_data);
+
+void simReset(void)
+{
+  pthread_mutex_lock(&gs_irqLock);
+
+  memset(&g_sim, 0, sizeof(g_sim));
+
+  g_sim.present = 1;
+  g_sim.id[0] = 0xAB;
+  g_sim.id[1] = 0x83;
+  g_sim.batDelay = 50;
+  g_sim.batResult = CMD_DEV_RDY;
+  g_sim.idDelay = 5;
+  g_sim.sendID = 1;
+
+  gs_head = 0;
+  gs_tail = 0;
+  gs_lastDue = simTimer;
+  gs_busyUntil = simTimer;
+  gp_tickHook = NULL;
+
+  memset((void *)simIO, 0, sizeof(simIO));
+
+  pthread_mutex_unlock(&gs_irqLock);
+}
+
+void setPS2_SIM_Device(struct s_ps2 *p_device)
+{
+  gp_ps2 = p_device;
+}
+
+void simStep(void)
+{
+  pthread_mutex_lock(&gs_irqLock);
+
+  simTimer++;
+
+  while((gs_head != gs_tail) && ((int16_t)(simTimer - gs_queue[gs_tail].due) >= 0))
+  {
+    uint16_t frame = gs_queue[gs_tail].frame;
+
+    gs_tail = (gs_tail + 1) % SIM_QUEUE_SIZE;
+
+    deliver(frame);
+  }
+
+  if(gp_tickHook != NULL) gp_tickHook();
+
+  pthread_mutex_unlock(&gs_irqLock);
+}
+
+void simRunIdle(void)
+{
+  while(gs_head != gs_tail) simStep();
+}
+
+void simSetTickHook(void (*p_hook)(void))
+{
+  pthread_mutex_lock(&gs_irqLock);
+
+  gp_tickHook = p_hook;
+
+  pthread_mutex_unlock(&gs_irqLock);
+}
+
+void simSchedule(uint8_t data, uint16_t delay, uint8_t parityError)
+{
+  //queue is empty, count the delay from now.
+  if(gs_head == gs_tail) gs_lastDue = simTimer;
+
+  gs_lastDue += delay;
+
+  gs_queue[gs_head].frame = simFrame(data, parityError);
+  gs_queue[gs_head].due = gs_lastDue;
+
+  gs_head = (gs_head + 1) % SIM_QUEUE_SIZE;
+}
+
+void simKey(uint8_t extended, uint8_t code, uint8_t release, uint16_t byteTicks)
+{
+  if(extended) simSchedule(0xE0, byteTicks, 0);
+
+  if(release) simSchedule(0xF0, byteTicks, 0);
+
+  simSchedule(code, byteTicks, 0);
+}
+
+uint16_t simType(const char *p_text, uint16_t byteTicks, uint16_t keyTicks)
+{
+  uint16_t keys = 0;
+  int index = 0;
+
+  for(; *p_text != '\0'; p_text++)
+  {
+    for(index = 0; gs_asciiCodes[index].ascii != '\0'; index++)
+    {
+      if(gs_asciiCodes[index].ascii == *p_text) break;
+    }
+
+    if(gs_asciiCodes[index].ascii == '\0') continue;
+
+    //keep room for one make and break, run the line until there is.
+    while(((gs_head + SIM_QUEUE_SIZE - gs_tail) % SIM_QUEUE_SIZE) > SIM_QUEUE_SIZE - 8) simStep();
+
+    simSchedule(gs_asciiCodes[index].code, keyTicks, 0);
+    simKey(0, gs_asciiCodes[index].code, 1, byteTicks);
+
+    keys++;
+  }
+
+  return keys;
+}
+
+uint16_t simFrame(uint8_t data, uint8_t parityError)
+{
+  uint16_t parity = !__builtin_parity(data);
+
+  if(parityError) parity ^= 1;
+
+  return ((uint16_t)data << 1) | (parity << 9) | (1 << 10);
+}
+
+void simStartClock(void)
+{
+  gs_clockRun = 1;
+
+  pthread_create(&gs_clockThread, NULL, &clockThread, NULL);
+}
+
+void simStopClock(void)
+{
+  gs_clockRun = 0;
+
+  pthread_join(gs_clockThread, NULL);
+}
+
+//PS2_BASE model
+void sendCommand(struct s_ps2 *p_ps2, uint8_t command)
+{
+  uint32_t steps = 0;
+
+  p_ps2->lastCMD = command;
+
+  if(hostByte(p_ps2, command)) return;
+
+  //spins on the ACK like PS2_BASE, which would hang here.
+  for(steps = 0; steps < SIM_WAIT_LIMIT; steps++) simStep();
+
+  g_sim.waitExpired++;
+}
+
+void sendCommand_noack(struct s_ps2 *p_ps2, uint8_t command)
+{
+  p_ps2->lastCMD = command;
+
+  //the answer still reaches the response callback, nothing waits for it.
+  hostByte(p_ps2, command);
+}
+
+void sendData(struct s_ps2 *p_ps2, uint8_t data)
+{
+  hostByte(p_ps2, data);
+}
+
+void waitForDevReady(struct s_ps2 *p_ps2)
+{
+  waitForState(p_ps2, ready_cmd);
+}
+
+void waitForDevID(struct s_ps2 *p_ps2)
+{
+  waitForState(p_ps2, dev_id);
+}
+
+void waitForDataIdle(struct s_ps2 *p_ps2)
+{
+  //host model sends and receives whole bytes, the line is always idle.
+  (void)p_ps2;
+}
+
+uint8_t convertToRaw(uint16_t ps2data)
+{
+  return (uint8_t)(ps2data >> 1);
+}
+
+static uint8_t hostByte(struct s_ps2 *p_ps2, uint8_t data)
+{
+  uint8_t answer = CMD_ACK;
+
+  pthread_mutex_lock(&gs_irqLock);
+
+  g_sim.hostBytes++;
+
+  //nothing clocks the byte in, no answer.
+  if(!g_sim.present)
+  {
+    pthread_mutex_unlock(&gs_irqLock);
+    return 0;
+  }
+
+  if(g_sim.injectResends)
+  {
+    g_sim.injectResends--;
+    g_sim.resends++;
+    answer = CMD_RESEND;
+  }
+  else if(g_sim.pendingCMD)
+  {
+    if(g_sim.pendingCMD == 0xED) g_sim.leds = data;
+    if(g_sim.pendingCMD == CMD_SET_RATE) g_sim.typematic = data;
+
+    g_sim.pendingCMD = 0;
+  }
+  else
+  {
+    switch(data)
+    {
+      case CMD_RESET:
+        g_sim.leds = 0;
+        simSchedule(g_sim.batResult, g_sim.batDelay, 0);
+        break;
+      case 0xED:
+      case CMD_SET_RATE:
+        g_sim.pendingCMD = data;
+        break;
+      case CMD_READ_ID:
+        if(g_sim.sendID)
+        {
+          simSchedule(g_sim.id[0], g_sim.idDelay, 0);
+          simSchedule(g_sim.id[1], g_sim.idDelay, 0);
+        }
+        break;
+      default:
+        break;
+    }
+  }
+
+  g_sim.devBytes++;
+
+  p_ps2->responseCallback(p_ps2, simFrame(answer, 0));
+
+  pthread_mutex_unlock(&gs_irqLock);
+
+  return 1;
+}
+
+static void deliver(uint16_t frame)
+{
+  if(gp_ps2 == NULL) return;
+
+  g_sim.devBytes++;
+
+  //clock edges of this frame came while the irq was still busy, the host never saw it.
+  if((int16_t)(simTimer - gs_busyUntil) < 0)
+  {
+    g_sim.overruns++;
+    return;
+  }
+
+  gs_busyUntil = simTimer + g_sim.serviceTicks;
+
+  if(gp_ps2->recvCallback != NULL)
+  {
+    gp_ps2->recvCallback(gp_ps2, frame);
+  }
+  else
+  {
+    gp_ps2->callUserCallback(gp_ps2, frame);
+  }
+}
+
+static void waitForState(struct s_ps2 *p_ps2, enum callbackStates state)
+{
+  uint32_t steps = 0;
+
+  for(steps = 0; steps < SIM_WAIT_LIMIT; steps++)
+  {
+    if(p_ps2->callbackState == state) return;
+
+    if(p_ps2->callbackState == resend_cmd)
+    {
+      p_ps2->callbackState = waiting;
+
+      sendCommand(p_ps2, p_ps2->lastCMD);
+    }
+
+    simStep();
+  }
+
+  //the real PS2_BASE would hang here.
+  g_sim.waitExpired++;
+}
+
+static void *clockThread(void *p_data)
+{
+  (void)p_data;
+
+  while(gs_clockRun)
+  {
+    simStep();
+
+    sched_yield();
+  }
+
+  return NULL;
+}
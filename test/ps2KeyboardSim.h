@@ -0,0 +1,161 @@
+/*******************************************************************************
+ * @file    ps2KeyboardSim.h
+ * @author  Jay Convertino(electrobs@gmail.com)
+ * @date    2024.03.12
+ * @brief   virtual PS2 keyboard and host model of PS2_BASE
+ * @version 0.0.0
+ *
+ * @TODO
+ *  - Cleanup interface
+ *
+ * @license mit
+ *
+ * Copyright 2024 Johnathan Convertino
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ ******************************************************************************/
+
+
+#ifndef _ps2KeyboardSim
+#define _ps2KeyboardSim
+
+#include <inttypes.h>
+
+#include "ps2base.h"
+
+//bytes the keyboard can have scheduled at once.
+#define SIM_QUEUE_SIZE 256
+
+//steps a blocking PS2_BASE wait model (sendCommand ACK, waitForDevReady,
+//waitForDevID) runs before giving up and counting waitExpired.
+#define SIM_WAIT_LIMIT 60000
+
+/**
+ * \brief Virtual keyboard state, setup fields may be changed between tests.
+ */
+struct s_ps2keyboardSim
+{
+  //setup
+  uint8_t present;
+  uint8_t id[2];
+  uint16_t batDelay;
+  uint8_t batResult;
+  uint16_t idDelay;
+  uint8_t sendID;
+  uint8_t injectResends;
+  //ticks the driver irq is busy per frame, a frame finishing sooner is lost.
+  uint16_t serviceTicks;
+
+  //keyboard side state set by host commands
+  uint8_t leds;
+  uint8_t typematic;
+  uint8_t pendingCMD;
+
+  //round trip counts
+  uint32_t hostBytes;
+  uint32_t devBytes;
+  uint32_t resends;
+  uint32_t waitExpired;
+  //frames lost because the previous frame was still being handled
+  uint32_t overruns;
+};
+
+extern struct s_ps2keyboardSim g_sim;
+
+/**
+ * \brief Reset the model to a present keyboard with default setup.
+ */
+void simReset(void);
+
+/**
+ * \brief IRQ port data setter handed to initPS2keyboard.
+ *
+ * \param p_device struct containing keyboard instance information
+ */
+void setPS2_SIM_Device(struct s_ps2 *p_device);
+
+/**
+ * \brief Advance the timer one tick and deliver every byte that is due.
+ */
+void simStep(void);
+
+/**
+ * \brief Run simStep until nothing is scheduled.
+ */
+void simRunIdle(void);
+
+/**
+ * \brief Call a function each tick, in irq context, for example a USART drain.
+ *
+ * \param p_hook function to call, NULL for none.
+ */
+void simSetTickHook(void (*p_hook)(void));
+
+/**
+ * \brief Schedule a keyboard to host byte.
+ *
+ * \param data byte to send.
+ * \param delay ticks after the previously scheduled byte.
+ * \param parityError 1 to send a wrong parity bit.
+ */
+void simSchedule(uint8_t data, uint16_t delay, uint8_t parityError);
+
+/**
+ * \brief Schedule make or break of a key.
+ *
+ * \param extended 1 for E0 prefixed keys.
+ * \param code set 2 make code.
+ * \param release 1 for the break sequence.
+ * \param byteTicks ticks between bytes of the sequence.
+ */
+void simKey(uint8_t extended, uint8_t code, uint8_t release, uint16_t byteTicks);
+
+/**
+ * \brief Schedule make and break of each character, a-z 0-9 space \r \b.
+ *
+ * \param p_text text to type.
+ * \param byteTicks ticks between bytes on the line.
+ * \param keyTicks ticks between one key and the next.
+ *
+ * \return number of keys scheduled.
+ */
+uint16_t simType(const char *p_text, uint16_t byteTicks, uint16_t keyTicks);
+
+/**
+ * \brief Build an 11 bit frame: start, 8 data bits, odd parity, stop.
+ *
+ * \param data byte in the frame.
+ * \param parityError 1 to flip the parity bit.
+ *
+ * \return frame as the driver callbacks receive it.
+ */
+uint16_t simFrame(uint8_t data, uint8_t parityError);
+
+/**
+ * \brief Run simStep from a second thread, models time passing in irqs
+ * while the driver spins on the timer.
+ */
+void simStartClock(void);
+
+/**
+ * \brief Stop the simStep thread.
+ */
+void simStopClock(void);
+
+#endif
@@ -0,0 +1,76 @@
+/*******************************************************************************
+ * @file    io.h
+ * @author  Jay Convertino(electrobs@gmail.com)
+ * @date    2024.03.12
+ * @brief   host model of avr-libc io registers for the tests
+ * @version 0.0.0
+ *
+ * @TODO
+ *  - Cleanup interface
+ *
+ * @license mit
+ *
+ * Copyright 2024 Johnathan Convertino
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ ******************************************************************************/
+
+
+#ifndef _SIM_AVR_IO
+#define _SIM_AVR_IO
+
+#include <inttypes.h>
+
+//register file, addresses match the atmega328p data space so p_port - 1 is DDR.
+extern volatile uint8_t simIO[0x100];
+
+//16 bit timer advanced by the keyboard model.
+extern volatile uint16_t simTimer;
+
+#define PINB    simIO[0x23]
+#define DDRB    simIO[0x24]
+#define PORTB   simIO[0x25]
+#define PINC    simIO[0x26]
+#define DDRC    simIO[0x27]
+#define PORTC   simIO[0x28]
+#define PIND    simIO[0x29]
+#define DDRD    simIO[0x2A]
+#define PORTD   simIO[0x2B]
+#define SREG    simIO[0x5F]
+#define PCICR   simIO[0x68]
+#define PCMSK0  simIO[0x6B]
+#define PCMSK1  simIO[0x6C]
+#define PCMSK2  simIO[0x6D]
+#define UCSR0A  simIO[0xC0]
+#define UCSR0B  simIO[0xC1]
+#define UDR0    simIO[0xC6]
+
+#define TCNT1   simTimer
+
+#define PCIE0   0
+#define PCIE1   1
+#define PCIE2   2
+#define UDRIE0  5
+
+#define PORTB0  0
+#define PORTB1  1
+#define PORTB2  2
+#define PORTB3  3
+
+#endif
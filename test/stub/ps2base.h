@@ -0,0 +1,85 @@
+/*******************************************************************************
+ * @file    ps2base.h
+ * @author  Jay Convertino(electrobs@gmail.com)
+ * @date    2024.03.12
+ * @brief   host model of the PS2_BASE interface used by the driver
+ * @version 0.0.0
+ *
+ * @TODO
+ *  - Cleanup interface
+ *
+ * @license mit
+ *
+ * Copyright 2024 Johnathan Convertino
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ ******************************************************************************/
+
+
+#ifndef _SIM_PS2_BASE
+#define _SIM_PS2_BASE
+
+#include <inttypes.h>
+
+#include "ps2defines.h"
+
+typedef void (*t_PS2userRecvCallback)(uint8_t recvBuffer);
+
+enum ackStates {ack, nack};
+
+enum dataStates {idle, busy};
+
+enum callbackStates {waiting, dev_id, ready_cmd, resend_cmd, ack_cmd, no_cmd};
+
+struct s_ps2
+{
+  void *p_device;
+
+  uint8_t clkPin;
+  uint8_t dataPin;
+  volatile uint8_t *p_port;
+
+  volatile enum ackStates lastAckState;
+  volatile enum dataStates dataState;
+  volatile enum callbackStates callbackState;
+
+  volatile uint8_t lastCMD;
+
+  t_PS2userRecvCallback userRecvCallback;
+
+  void (*recvCallback)(void *p_data, uint16_t ps2data);
+  void (*responseCallback)(void *p_data, uint16_t ps2data);
+  void (*callUserCallback)(void *p_data, uint16_t ps2data);
+};
+
+void sendCommand(struct s_ps2 *p_ps2, uint8_t command);
+
+void sendCommand_noack(struct s_ps2 *p_ps2, uint8_t command);
+
+void sendData(struct s_ps2 *p_ps2, uint8_t data);
+
+void waitForDevReady(struct s_ps2 *p_ps2);
+
+void waitForDevID(struct s_ps2 *p_ps2);
+
+void waitForDataIdle(struct s_ps2 *p_ps2);
+
+uint8_t convertToRaw(uint16_t ps2data);
+
+#endif
@@ -0,0 +1,949 @@
+/*******************************************************************************
+ * @file    testPS2keyboard.c
+ * @author  Jay Convertino(electrobs@gmail.com)
+ * @date    2024.03.12
+ * @brief   host tests of the keyboard driver against the virtual keyboard
+ * @version 0.0.0
+ *
+ * @TODO
+ *  - Cleanup interface
+ *
+ * @license mit
+ *
+ * Copyright 2024 Johnathan Convertino
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ ******************************************************************************/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <avr/io.h>
+
+#include "ps2Keyboard.h"
+#include "ps2KeyboardSim.h"
+
+#define CHECK(cond) do { g_checks++; if(!(cond)) { g_failures++; printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); } } while(0)
+
+//driver internals under test, not part of the public header.
+void setPS2leds(struct s_ps2 *p_ps2keyboard, uint8_t caps, uint8_t num, uint8_t scroll);
+void getID(void *p_data, uint16_t ps2Data);
+void checkKeyboardResponse(void *p_data, uint16_t ps2Data);
+void extractData(void *p_data, uint16_t ps2data);
+
+static int g_checks = 0;
+static int g_failures = 0;
+
+static struct s_ps2 g_ps2;
+
+static uint16_t g_makes = 0;
+static uint16_t g_breaks = 0;
+static uint8_t g_lastDefine = 0;
+static uint8_t g_hotplugs = 0;
+
+//decoded events in order, define in the low byte, 1 in the high byte for a break.
+static uint16_t g_events[1024];
+static uint16_t g_eventCount = 0;
+
+static uint8_t g_subscriberCount[4];
+
+static char g_line[16];
+static uint8_t g_lineLength = 0;
+static uint8_t g_lineCount = 0;
+static char *gp_line = NULL;
+
+static struct s_ps2stream g_stream;
+static struct s_ps2stream *gp_stream = NULL;
+static uint16_t g_uartTicks = 0;
+static uint16_t g_uartCount = 0;
+static uint32_t g_uartBytes = 0;
+
+static void recvCallback(uint8_t recvBuffer)
+{
+  if(!recvBuffer) return;
+
+  if(getPS2keyReleased(&g_ps2))
+  {
+    g_breaks++;
+  }
+  else
+  {
+    g_makes++;
+  }
+
+  if(g_eventCount < sizeof(g_events)/sizeof(g_events[0]))
+  {
+    g_events[g_eventCount++] = recvBuffer | (getPS2keyReleased(&g_ps2) << 8);
+  }
+
+  g_lastDefine = recvBuffer;
+}
+
+static void hotplugCallback(void)
+{
+  g_hotplugs++;
+}
+
+static void subscriber0(uint8_t recvBuffer)
+{
+  (void)recvBuffer;
+  g_subscriberCount[0]++;
+}
+
+static void subscriber1(uint8_t recvBuffer)
+{
+  (void)recvBuffer;
+  g_subscriberCount[1]++;
+}
+
+static void subscriber2(uint8_t recvBuffer)
+{
+  (void)recvBuffer;
+  g_subscriberCount[2]++;
+}
+
+static void subscriber3(uint8_t recvBuffer)
+{
+  (void)recvBuffer;
+  g_subscriberCount[3]++;
+}
+
+static void lineCallback(char *p_line, uint8_t length)
+{
+  strncpy(g_line, p_line, sizeof(g_line) - 1);
+
+  gp_line = p_line;
+  g_lineLength = length;
+  g_lineCount++;
+}
+
+static void setStream(struct s_ps2stream *p_stream)
+{
+  gp_stream = p_stream;
+}
+
+//USART data register empty irq model, one byte every g_uartTicks.
+static void uartTick(void)
+{
+  if(++g_uartCount < g_uartTicks) return;
+
+  g_uartCount = 0;
+
+  if(!(UCSR0B & (1 << UDRIE0))) return;
+
+  drainPS2stream(gp_stream);
+
+  if(UCSR0B & (1 << UDRIE0)) g_uartBytes++;
+}
+
+static void setupKeyboard(void)
+{
+  simReset();
+
+  g_makes = 0;
+  g_breaks = 0;
+  g_lastDefine = 0;
+  g_hotplugs = 0;
+  g_eventCount = 0;
+
+  initPS2keyboard(&g_ps2, &recvCallback, &setPS2_SIM_Device, &PORTB, PORTB0, PORTB1);
+}
+
+static void teardownKeyboard(void)
+{
+  free(g_ps2.p_device);
+
+  g_ps2.p_device = NULL;
+}
+
+static void testInit(void)
+{
+  setupKeyboard();
+
+  //reset, set LED command, LED data.
+  CHECK(g_sim.hostBytes == 3);
+  CHECK(g_sim.waitExpired == 0);
+  CHECK(g_ps2.callbackState != no_cmd);
+  CHECK(g_sim.leds == 0);
+  CHECK(DDRB == 0);
+  CHECK(PCMSK0 == (1 << PORTB0));
+
+  printf("  init: %u host bytes, %u keyboard bytes\n", g_sim.hostBytes, g_sim.devBytes);
+
+  teardownKeyboard();
+}
+
+static void testResetResend(void)
+{
+  uint32_t hostBytes = 0;
+  uint32_t devBytes = 0;
+
+  setupKeyboard();
+
+  hostBytes = g_sim.hostBytes;
+  devBytes = g_sim.devBytes;
+
+  g_sim.injectResends = 2;
+
+  resetPS2keyboard(&g_ps2);
+
+  CHECK(g_sim.resends == 2);
+  CHECK(g_sim.waitExpired == 0);
+  CHECK(g_ps2.callbackState == ready_cmd);
+  CHECK(g_ps2.recvCallback == &extractData);
+
+  printf("  reset with 2 resends: %u host bytes, %u keyboard bytes\n", g_sim.hostBytes - hostBytes, g_sim.devBytes - devBytes);
+
+  teardownKeyboard();
+}
+
+static void testLEDs(void)
+{
+  setupKeyboard();
+
+  setPS2leds(&g_ps2, 1, 0, 1);
+
+  CHECK(g_sim.leds == (LED_CAPS | LED_SCROLL));
+  CHECK(getPS2capsLockState(&g_ps2) == 1);
+  CHECK(getPS2numLockState(&g_ps2) == 0);
+  CHECK(getPS2scrollLockState(&g_ps2) == 1);
+  CHECK(getPS2snapshotLEDs(&g_ps2) == (LED_CAPS | LED_SCROLL));
+
+  //caps lock key toggles the LED once per press.
+  simKey(0, 0x58, 0, 2);
+  simKey(0, 0x58, 0, 2);
+  simKey(0, 0x58, 1, 2);
+  simRunIdle();
+
+  updatePS2leds(&g_ps2);
+
+  CHECK(g_sim.leds == LED_SCROLL);
+
+  teardownKeyboard();
+}
+
+static void testTypematic(void)
+{
+  setupKeyboard();
+
+  setPS2typmaticRateDelay(&g_ps2, 2, 0x14);
+
+  CHECK(g_sim.typematic == ((2 << 5) | 0x14));
+
+  //out of range values fall back to defaults.
+  setPS2typmaticRateDelay(&g_ps2, 9, 0x3F);
+
+  CHECK(g_sim.typematic == ((DEFAULT_DELAY << 5) | DEFAULT_RATE));
+
+  teardownKeyboard();
+}
+
+static void testReadID(void)
+{
+  uint32_t hostBytes = 0;
+  uint32_t devBytes = 0;
+
+  setupKeyboard();
+
+  hostBytes = g_sim.hostBytes;
+  devBytes = g_sim.devBytes;
+
+  g_sim.id[0] = 0xAB;
+  g_sim.id[1] = 0x41;
+
+  sendPS2readIDcmd(&g_ps2);
+
+  CHECK(g_sim.waitExpired == 0);
+  CHECK(getPS2keyboardID(&g_ps2) == 0x41AB);
+
+  printf("  read ID: %u host bytes, %u keyboard bytes\n", g_sim.hostBytes - hostBytes, g_sim.devBytes - devBytes);
+
+  //keys after the ID are decoded again.
+  simType("a", 2, 10);
+  simRunIdle();
+
+  CHECK(g_makes == 1);
+  CHECK(g_breaks == 1);
+  CHECK(g_lastDefine == 'a');
+
+  teardownKeyboard();
+}
+
+static void testCheckKeyboardResponse(void)
+{
+  struct s_ps2keyboardState state;
+
+  setupKeyboard();
+
+  readPS2snapshot(&g_ps2, &state);
+
+  g_ps2.lastCMD = CMD_READ_ID;
+  checkKeyboardResponse(&g_ps2, simFrame(CMD_ACK, 0));
+
+  CHECK(g_ps2.callbackState == ack_cmd);
+  CHECK(g_ps2.recvCallback == &getID);
+
+  g_ps2.lastCMD = CMD_RESET;
+  checkKeyboardResponse(&g_ps2, simFrame(CMD_ACK, 0));
+
+  CHECK(g_ps2.recvCallback == &checkKeyboardResponse);
+
+  checkKeyboardResponse(&g_ps2, simFrame(CMD_DEV_RDY, 0));
+
+  CHECK(g_ps2.callbackState == ready_cmd);
+  CHECK(g_ps2.recvCallback == &extractData);
+
+  checkKeyboardResponse(&g_ps2, simFrame(CMD_RESEND, 0));
+
+  CHECK(g_ps2.callbackState == resend_cmd);
+
+  checkKeyboardResponse(&g_ps2, simFrame(RESP_BAT_FAIL, 0));
+
+  CHECK(g_ps2.callbackState == no_cmd);
+
+  CHECK(g_ps2.p_device != NULL);
+
+  {
+    struct s_ps2keyboardState after;
+
+    readPS2snapshot(&g_ps2, &after);
+
+    CHECK(after.cmdAckCount == state.cmdAckCount + 2);
+    CHECK(after.cmdResendCount == state.cmdResendCount + 1);
+    CHECK(after.cmdErrorCount == state.cmdErrorCount + 1);
+  }
+
+  teardownKeyboard();
+}
+
+static void testGetID(void)
+{
+  setupKeyboard();
+
+  g_ps2.recvCallback = &getID;
+
+  getID(&g_ps2, simFrame(0x12, 0));
+
+  CHECK(g_ps2.callbackState == waiting);
+  CHECK(g_ps2.recvCallback == &getID);
+
+  getID(&g_ps2, simFrame(0x34, 0));
+
+  CHECK(g_ps2.callbackState == dev_id);
+  CHECK(getPS2keyboardID(&g_ps2) == 0x3412);
+  CHECK(g_ps2.recvCallback == &extractData);
+
+  teardownKeyboard();
+}
+
+static void testMultiByteKeys(void)
+{
+  struct s_ps2keyboardState state;
+
+  setupKeyboard();
+
+  simKey(1, 0x75, 0, 2);
+  simRunIdle();
+
+  CHECK(g_lastDefine == KEYCODE_UARROW);
+  CHECK(g_makes == 1);
+
+  simKey(1, 0x75, 1, 2);
+  simRunIdle();
+
+  CHECK(g_lastDefine == KEYCODE_UARROW);
+  CHECK(g_breaks == 1);
+
+  //print screen make and break.
+  simKey(1, 0x12, 0, 2);
+  simKey(1, 0x7C, 0, 2);
+  simRunIdle();
+
+  CHECK(g_lastDefine == KEYCODE_PRTSCR);
+  CHECK(g_makes == 2);
+
+  simKey(1, 0x7C, 1, 2);
+  simKey(1, 0x12, 1, 2);
+  simRunIdle();
+
+  CHECK(g_lastDefine == KEYCODE_PRTSCR);
+  CHECK(g_breaks == 2);
+
+  //pause, 8 bytes with no break.
+  simSchedule(0xE1, 2, 0);
+  simKey(0, 0x14, 0, 2);
+  simKey(0, 0x77, 0, 2);
+  simSchedule(0xE1, 2, 0);
+  simKey(0, 0x14, 1, 2);
+  simKey(0, 0x77, 1, 2);
+  simRunIdle();
+
+  CHECK(g_lastDefine == KEYCODE_PAUSE);
+
+  readPS2snapshot(&g_ps2, &state);
+
+  CHECK(state.lostEventCount == 0);
+  CHECK(state.lastEvent == KEYCODE_PAUSE);
+
+  teardownKeyboard();
+}
+
+static void testHotplug(void)
+{
+  struct s_ps2keyboardState state;
+  uint8_t typematic = 0;
+
+  setupKeyboard();
+
+  setPS2hotplugCallback(&g_ps2, &hotplugCallback);
+
+  setPS2leds(&g_ps2, 0, 1, 0);
+  setPS2typmaticRateDelay(&g_ps2, 3, 0x1F);
+
+  typematic = g_sim.typematic;
+
+  //unplug and plug, the new keyboard starts with defaults.
+  g_sim.leds = 0;
+  g_sim.typematic = 0;
+
+  simSchedule(CMD_DEV_RDY, 10, 0);
+  simRunIdle();
+
+  updatePS2leds(&g_ps2);
+  updatePS2leds(&g_ps2);
+  updatePS2leds(&g_ps2);
+
+  CHECK(g_sim.leds == LED_NUM);
+  CHECK(g_sim.typematic == typematic);
+  CHECK(g_hotplugs == 1);
+
+  readPS2snapshot(&g_ps2, &state);
+
+  CHECK(state.hotplugCount == 1);
+  CHECK(state.id == 0);
+
+  teardownKeyboard();
+}
+
+static void testRawMode(void)
+{
+  struct s_ps2rawBuffer raw;
+  uint8_t data[8];
+  uint8_t flags[8];
+  uint8_t outData[8];
+  uint8_t outFlags[8];
+  uint8_t count = 0;
+
+  setupKeyboard();
+
+  setPS2rawMode(&g_ps2, &raw, data, flags, sizeof(data));
+
+  simSchedule(0x1C, 2, 0);
+  simSchedule(0xAA, 2, 1);
+  simRunIdle();
+
+  count = readPS2raw(&raw, outData, outFlags, sizeof(outData));
+
+  CHECK(count == 2);
+  CHECK(outData[0] == 0x1C);
+  CHECK(outFlags[0] == 0);
+  CHECK(outData[1] == 0xAA);
+  CHECK(outFlags[1] == RAW_PARITY_ERROR);
+  CHECK(g_makes == 0);
+
+  teardownKeyboard();
+}
+
+static void testTimeouts(void)
+{
+  enum ps2Status status = ps2_ok;
+
+  //nothing plugged in.
+  simReset();
+  g_sim.present = 0;
+
+  simStartClock();
+  status = initPS2keyboardTimeout(&g_ps2, &recvCallback, &setPS2_SIM_Device, &PORTB, PORTB0, PORTB1, &TCNT1, 500);
+  simStopClock();
+
+  CHECK(status == ps2_timeout);
+  CHECK(getPS2lastWaitTicks(&g_ps2) >= 500);
+  CHECK(g_ps2.recvCallback == &extractData);
+
+  //no send spun on a missing ACK.
+  CHECK(g_sim.waitExpired == 0);
+
+  //the unbounded reset does, the model counts where it would hang.
+  resetPS2keyboard(&g_ps2);
+
+  CHECK(g_sim.waitExpired > 0);
+
+  teardownKeyboard();
+
+  //keyboard fails its self test.
+  simReset();
+  g_sim.batResult = RESP_BAT_FAIL;
+
+  simStartClock();
+  status = initPS2keyboardTimeout(&g_ps2, &recvCallback, &setPS2_SIM_Device, &PORTB, PORTB0, PORTB1, &TCNT1, 5000);
+  simStopClock();
+
+  CHECK(status == ps2_nak);
+  CHECK(g_ps2.recvCallback == &extractData);
+
+  teardownKeyboard();
+
+  //good keyboard, the wait is about the BAT delay.
+  simReset();
+  g_sim.batDelay = 200;
+
+  simStartClock();
+  status = initPS2keyboardTimeout(&g_ps2, &recvCallback, &setPS2_SIM_Device, &PORTB, PORTB0, PORTB1, &TCNT1, 5000);
+  simStopClock();
+
+  CHECK(status == ps2_ok);
+  CHECK(getPS2lastWaitTicks(&g_ps2) >= 200);
+  CHECK(getPS2lastWaitTicks(&g_ps2) < 5000);
+  CHECK(getPS2maxWaitTicks(&g_ps2) >= getPS2lastWaitTicks(&g_ps2));
+  CHECK(g_sim.leds == 0);
+
+  //keyboard keeps asking for resends.
+  g_sim.injectResends = 100;
+
+  simStartClock();
+  status = resetPS2keyboardTimeout(&g_ps2, 5000);
+  simStopClock();
+
+  CHECK(status == ps2_resend_exhausted);
+  CHECK(g_sim.resends == PS2_MAX_RESENDS + 1);
+
+  teardownKeyboard();
+
+  //keyboard ACKs read ID but sends one ID byte only.
+  setupKeyboard();
+  setPS2timeoutTimer(&g_ps2, &TCNT1);
+
+  g_sim.sendID = 0;
+  simSchedule(0xAB, 50, 0);
+
+  simStartClock();
+  status = sendPS2readIDcmdTimeout(&g_ps2, 500);
+  simStopClock();
+
+  CHECK(status == ps2_timeout);
+  CHECK(g_ps2.recvCallback == &extractData);
+
+  //keys are decoded, not eaten as ID bytes.
+  simType("a", 2, 10);
+  simRunIdle();
+
+  CHECK(g_makes == 1);
+  CHECK(g_lastDefine == 'a');
+
+  //next ID read is aligned.
+  g_sim.sendID = 1;
+
+  simStartClock();
+  status = sendPS2readIDcmdTimeout(&g_ps2, 5000);
+  simStopClock();
+
+  CHECK(status == ps2_ok);
+  CHECK(getPS2keyboardID(&g_ps2) == 0x83AB);
+
+  teardownKeyboard();
+}
+
+static void testSubscribers(void)
+{
+  int8_t slot[4];
+
+  setupKeyboard();
+
+  memset(g_subscriberCount, 0, sizeof(g_subscriberCount));
+
+  slot[0] = subscribePS2keyboard(&g_ps2, &subscriber0, FILTER_MAKE | FILTER_PRINTABLE, 0, 0);
+  slot[1] = subscribePS2keyboard(&g_ps2, &subscriber1, FILTER_BREAK | FILTER_CLASS, 0, 0);
+  slot[2] = subscribePS2keyboard(&g_ps2, &subscriber2, FILTER_DIRECTION | FILTER_MODIFIER, 0, 0);
+  slot[3] = subscribePS2keyboard(&g_ps2, &subscriber3, FILTER_ALL | FILTER_RANGE, 'a', 'c');
+
+  CHECK((slot[0] == 0) && (slot[1] == 1) && (slot[2] == 2) && (slot[3] == 3));
+
+  //table is full.
+  CHECK(subscribePS2keyboard(&g_ps2, &subscriber0, FILTER_ALL, 0, 0) == -1);
+
+  //a, x, left shift, F1 make and break.
+  simKey(0, 0x1C, 0, 2);
+  simKey(0, 0x1C, 1, 2);
+  simKey(0, 0x22, 0, 2);
+  simKey(0, 0x22, 1, 2);
+  simKey(0, 0x12, 0, 2);
+  simKey(0, 0x12, 1, 2);
+  simKey(0, 0x05, 0, 2);
+  simKey(0, 0x05, 1, 2);
+  simRunIdle();
+
+  //make only printable: a, x.
+  CHECK(g_subscriberCount[0] == 2);
+  //break only, any class: all four keys.
+  CHECK(g_subscriberCount[1] == 4);
+  //modifier: shift make and break.
+  CHECK(g_subscriberCount[2] == 2);
+  //range a to c: a make and break.
+  CHECK(g_subscriberCount[3] == 2);
+  //the initPS2keyboard callback still sees every key.
+  CHECK((g_makes == 4) && (g_breaks == 4));
+
+  //the freed slot is reused, low > high wraps through 0 and takes F1 and a but not x.
+  unsubscribePS2keyboard(&g_ps2, slot[0]);
+
+  CHECK(subscribePS2keyboard(&g_ps2, &subscriber0, FILTER_MAKE | FILTER_CLASS | FILTER_RANGE, 200, 'b') == slot[0]);
+
+  memset(g_subscriberCount, 0, sizeof(g_subscriberCount));
+
+  simKey(0, 0x1C, 0, 2);
+  simKey(0, 0x22, 0, 2);
+  simKey(0, 0x05, 0, 2);
+  simKey(1, 0x75, 0, 2);
+  simRunIdle();
+
+  CHECK(g_subscriberCount[0] == 2);
+  CHECK(g_subscriberCount[1] == 0);
+
+  //an unsubscribed callback is not called.
+  unsubscribePS2keyboard(&g_ps2, slot[3]);
+
+  simKey(0, 0x1C, 1, 2);
+  simRunIdle();
+
+  CHECK(g_subscriberCount[3] == 1);
+  CHECK(g_subscriberCount[1] == 1);
+
+  teardownKeyboard();
+}
+
+static void testLineMode(void)
+{
+  char line[16];
+  char shortLine[5];
+
+  setupKeyboard();
+
+  memset(g_line, 0, sizeof(g_line));
+  g_lineCount = 0;
+
+  setPS2lineMode(&g_ps2, line, sizeof(line), &lineCallback);
+
+  //backspace edits in place, enter completes the line.
+  simType("ab\bcd", 2, 10);
+  simRunIdle();
+
+  CHECK(g_lineCount == 0);
+
+  simType("\r", 2, 10);
+  simRunIdle();
+
+  CHECK(g_lineCount == 1);
+  CHECK(g_lineLength == 3);
+  CHECK(!strcmp(g_line, "acd"));
+  //the line is handed over in the user buffer, not a copy.
+  CHECK(gp_line == line);
+
+  //backspace on an empty line does nothing.
+  simType("\b\bx\r", 2, 10);
+  simRunIdle();
+
+  CHECK(g_lineCount == 2);
+  CHECK(!strcmp(g_line, "x"));
+
+  //an empty line is still delivered.
+  simType("\r", 2, 10);
+  simRunIdle();
+
+  CHECK(g_lineCount == 3);
+  CHECK(g_lineLength == 0);
+
+  //caps lock applies to letters only.
+  simKey(0, 0x58, 0, 2);
+  simKey(0, 0x58, 1, 2);
+  simType("a1 b\r", 2, 10);
+  simRunIdle();
+
+  CHECK(!strcmp(g_line, "A1 B"));
+
+  simKey(0, 0x58, 0, 2);
+  simKey(0, 0x58, 1, 2);
+  simRunIdle();
+
+  //line keys and their releases never reach the initPS2keyboard callback, other keys do.
+  CHECK((g_makes == 0) && (g_breaks == 0));
+
+  simKey(0, 0x05, 0, 2);
+  simKey(0, 0x05, 1, 2);
+  simRunIdle();
+
+  CHECK((g_makes == 1) && (g_breaks == 1) && (g_lastDefine == KEYCODE_F1));
+
+  //a full buffer completes the line, size - 1 characters plus the terminator.
+  g_lineCount = 0;
+
+  setPS2lineMode(&g_ps2, shortLine, sizeof(shortLine), &lineCallback);
+
+  simType("ab\bcd\r", 2, 10);
+  simRunIdle();
+
+  CHECK(g_lineCount == 1);
+  CHECK(!strcmp(g_line, "acd"));
+
+  simType("abcdef", 2, 10);
+  simRunIdle();
+
+  CHECK(g_lineCount == 2);
+  CHECK(g_lineLength == sizeof(shortLine) - 1);
+  CHECK(!strcmp(g_line, "abcd"));
+  CHECK(shortLine[sizeof(shortLine) - 1] == '\0');
+
+  //the rest starts a new line.
+  simType("\r", 2, 10);
+  simRunIdle();
+
+  CHECK(g_lineCount == 3);
+  CHECK(!strcmp(g_line, "ef"));
+
+  //line mode off, keys go to the callback again.
+  setPS2lineMode(&g_ps2, NULL, 0, NULL);
+
+  simType("a", 2, 10);
+  simRunIdle();
+
+  CHECK(g_lineCount == 3);
+  CHECK((g_makes == 2) && (g_lastDefine == 'a'));
+
+  teardownKeyboard();
+}
+
+static void testStreamRecords(void)
+{
+  uint8_t *p_record = NULL;
+
+  setupKeyboard();
+
+  initPS2stream(&g_ps2, &g_stream, &TCNT1, &setStream);
+
+  //gap longer than 255 ticks must saturate, not wrap.
+  simKey(0, 0x1C, 0, 300);
+  simKey(0, 0x1C, 1, 2);
+  simKey(1, 0x75, 0, 5);
+  simKey(1, 0x75, 1, 3);
+
+  //pause, 8 bytes one tick apart.
+  simSchedule(0xE1, 1, 0);
+  simKey(0, 0x14, 0, 1);
+  simKey(0, 0x77, 0, 1);
+  simSchedule(0xE1, 1, 0);
+  simKey(0, 0x14, 1, 1);
+  simKey(0, 0x77, 1, 1);
+
+  simKey(1, 0x7C, 1, 20);
+  simKey(1, 0x12, 1, 20);
+  simRunIdle();
+
+  CHECK(g_stream.fillCount == 6 * STREAM_RECORD_SIZE);
+  CHECK(getPS2streamOverflow(&g_stream) == 0);
+  CHECK(UCSR0B & (1 << UDRIE0));
+
+  p_record = g_stream.buffer[g_stream.fillBuffer];
+
+  CHECK((p_record[0] == 0x1C) && (p_record[1] == STREAM_DELTA_MASK));
+  CHECK((p_record[2] == 0x1C) && (p_record[3] == (STREAM_BREAK_BIT | 4)));
+  CHECK((p_record[4] == 0x75) && (p_record[5] == (STREAM_EXTENDED_BIT | 10)));
+  CHECK((p_record[6] == 0x75) && (p_record[7] == (STREAM_BREAK_BIT | STREAM_EXTENDED_BIT | 9)));
+  CHECK((p_record[8] == 0x77) && (p_record[9] == (STREAM_EXTENDED_BIT | 8)));
+  CHECK((p_record[10] == 0x7C) && (p_record[11] == (STREAM_BREAK_BIT | STREAM_EXTENDED_BIT | STREAM_DELTA_MASK)));
+
+  CHECK(getPS2streamOverflow(NULL) == 0);
+
+  teardownKeyboard();
+}
+
+//longest common subsequence of the typed and decoded events, events decoded right and in order.
+static uint16_t matchEvents(const uint16_t *p_expected, uint16_t expectedCount)
+{
+  static uint16_t row[2][sizeof(g_events)/sizeof(g_events[0]) + 1];
+
+  uint16_t expected = 0;
+  uint16_t received = 0;
+  uint16_t *p_prev = NULL;
+  uint16_t *p_curr = NULL;
+
+  memset(row, 0, sizeof(row));
+
+  for(expected = 1; expected <= expectedCount; expected++)
+  {
+    p_prev = row[(expected - 1) & 1];
+    p_curr = row[expected & 1];
+
+    for(received = 1; received <= g_eventCount; received++)
+    {
+      if(p_expected[expected - 1] == g_events[received - 1])
+      {
+        p_curr[received] = p_prev[received - 1] + 1;
+      }
+      else
+      {
+        p_curr[received] = (p_prev[received] > p_curr[received - 1] ? p_prev[received] : p_curr[received - 1]);
+      }
+    }
+  }
+
+  return row[expectedCount & 1][g_eventCount];
+}
+
+static void testTypingRates(void)
+{
+  static const char text[] = "the quick brown fox jumps over the lazy dog 0123456789 ";
+
+  //one tick is 100 us: a 1 ms byte time on the line, 10 and 30 keys/s, a
+  //burst, and an irq handler that is slower than the line.
+  static const uint16_t rates[][3] =
+  {
+    {2, 10, 1000},
+    {2, 10, 333},
+    {2, 10, 20},
+    {12, 10, 333}
+  };
+
+  static uint16_t expected[sizeof(g_events)/sizeof(g_events[0])];
+
+  struct s_ps2keyboardState state;
+  uint16_t keys = 0;
+  uint16_t expectedCount = 0;
+  uint16_t matched = 0;
+  uint16_t lost = 0;
+  uint16_t spurious = 0;
+  unsigned int index = 0;
+  int repeat = 0;
+  const char *p_char = NULL;
+
+  printf("  service  byte  key  typed  decoded  lost  spurious  overrun  garbled  stream overflow  uart bytes\n");
+
+  for(index = 0; index < sizeof(rates)/sizeof(rates[0]); index++)
+  {
+    setupKeyboard();
+
+    initPS2stream(&g_ps2, &g_stream, &TCNT1, &setStream);
+
+    g_sim.serviceTicks = rates[index][0];
+
+    //about 9600 baud.
+    g_uartTicks = 10;
+    g_uartCount = 0;
+    g_uartBytes = 0;
+
+    simSetTickHook(&uartTick);
+
+    for(keys = 0, expectedCount = 0, repeat = 0; repeat < 4; repeat++)
+    {
+      keys += simType(text, rates[index][1], rates[index][2]);
+
+      for(p_char = text; *p_char != '\0'; p_char++)
+      {
+        expected[expectedCount++] = (uint8_t)*p_char;
+        expected[expectedCount++] = (uint8_t)*p_char | (1 << 8);
+      }
+    }
+
+    simRunIdle();
+
+    //let the USART finish.
+    for(repeat = 0; repeat < 20000; repeat++) simStep();
+
+    simSetTickHook(NULL);
+
+    readPS2snapshot(&g_ps2, &state);
+
+    matched = matchEvents(expected, expectedCount);
+    lost = expectedCount - matched;
+    spurious = g_eventCount - matched;
+
+    printf("  %7u  %4u  %4u  %5u  %7u  %4u  %8u  %7u  %7u  %15u  %10u\n", rates[index][0], rates[index][1], rates[index][2], expectedCount, g_eventCount, lost, spurious, g_sim.overruns, state.lostEventCount, getPS2streamOverflow(&g_stream), g_uartBytes);
+
+    CHECK(expectedCount == keys * 2);
+
+    //a handler faster than the line misses nothing, a slower one must show losses.
+    if(rates[index][0] < rates[index][1])
+    {
+      CHECK(g_sim.overruns == 0);
+      CHECK(lost == 0);
+      CHECK(spurious == 0);
+    }
+    else
+    {
+      CHECK(g_sim.overruns > 0);
+      CHECK(lost > 0);
+    }
+
+    //every decoded event is either sent or counted, unless the counter saturated.
+    if(getPS2streamOverflow(&g_stream) < 0xFF)
+    {
+      CHECK(g_uartBytes + getPS2streamOverflow(&g_stream) * STREAM_RECORD_SIZE == (uint32_t)state.eventCount * STREAM_RECORD_SIZE);
+    }
+
+    teardownKeyboard();
+  }
+}
+
+int main(void)
+{
+  printf("init\n");
+  testInit();
+  printf("reset resend\n");
+  testResetResend();
+  printf("leds\n");
+  testLEDs();
+  printf("typematic\n");
+  testTypematic();
+  printf("read id\n");
+  testReadID();
+  printf("check keyboard response\n");
+  testCheckKeyboardResponse();
+  printf("get id\n");
+  testGetID();
+  printf("multi byte keys\n");
+  testMultiByteKeys();
+  printf("hot plug\n");
+  testHotplug();
+  printf("raw mode\n");
+  testRawMode();
+  printf("timeouts\n");
+  testTimeouts();
+  printf("subscribers\n");
+  testSubscribers();
+  printf("line mode\n");
+  testLineMode();
+  printf("stream records\n");
+  testStreamRecords();
+  printf("typing rates\n");
+  testTypingRates();
+
+  printf("%d checks, %d failures\n", g_checks, g_failures);
+
+  return (g_failures ? EXIT_FAILURE : EXIT_SUCCESS);
+}
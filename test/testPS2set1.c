@@ -0,0 +1,190 @@
+/*******************************************************************************
+ * @file    testPS2set1.c
+ * @author  Jay Convertino(electrobs@gmail.com)
+ * @date    2024.03.12
+ * @brief   host tests of set 1 (XT) translation
+ * @version 0.0.0
+ *
+ * @TODO
+ *  - Cleanup interface
+ *
+ * @license mit
+ *
+ * Copyright 2024 Johnathan Convertino
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ ******************************************************************************/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <avr/io.h>
+
+#include "ps2Keyboard.h"
+#include "ps2KeyboardSim.h"
+
+#define CHECK(cond) do { g_checks++; if(!(cond)) { g_failures++; printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); } } while(0)
+
+//bytes per throughput run.
+#define THROUGHPUT_BYTES 4000000UL
+
+//driver internals under test, not part of the public header.
+void translatePS2set1(struct s_ps2 *p_ps2keyboard, uint8_t ps2data);
+void resetPS2decoder(struct s_ps2 *p_ps2keyboard);
+void extractData(void *p_data, uint16_t ps2data);
+
+static int g_checks = 0;
+static int g_failures = 0;
+
+static struct s_ps2 g_ps2;
+
+static uint8_t g_set1[64];
+static uint8_t g_set1Count = 0;
+static uint32_t g_set1Total = 0;
+
+static void recvCallback(uint8_t recvBuffer)
+{
+  (void)recvBuffer;
+}
+
+static void set1Callback(uint8_t set1Data)
+{
+  if(g_set1Count < sizeof(g_set1)) g_set1[g_set1Count] = set1Data;
+
+  g_set1Count++;
+}
+
+static void set1CountCallback(uint8_t set1Data)
+{
+  (void)set1Data;
+
+  g_set1Total++;
+}
+
+//send set 2 bytes through the keyboard model and compare the set 1 output.
+static int translate(const uint8_t *p_set2, uint8_t set2Length, const uint8_t *p_set1, uint8_t set1Length)
+{
+  uint8_t index = 0;
+
+  g_set1Count = 0;
+
+  for(index = 0; index < set2Length; index++) simSchedule(p_set2[index], 2, 0);
+
+  simRunIdle();
+
+  return (g_set1Count == set1Length) && !memcmp(g_set1, p_set1, set1Length);
+}
+
+static void testSequences(void)
+{
+  static const uint8_t pause2[] = {0xE1, 0x14, 0x77, 0xE1, 0xF0, 0x14, 0xF0, 0x77};
+  static const uint8_t pause1[] = {0xE1, 0x1D, 0x45, 0xE1, 0x9D, 0xC5};
+  static const uint8_t prtscrMake2[] = {0xE0, 0x12, 0xE0, 0x7C};
+  static const uint8_t prtscrMake1[] = {0xE0, 0x2A, 0xE0, 0x37};
+  static const uint8_t prtscrBreak2[] = {0xE0, 0xF0, 0x7C, 0xE0, 0xF0, 0x12};
+  static const uint8_t prtscrBreak1[] = {0xE0, 0xB7, 0xE0, 0xAA};
+  static const uint8_t upBreak2[] = {0xE0, 0xF0, 0x75};
+  static const uint8_t upBreak1[] = {0xE0, 0xC8};
+  static const uint8_t a2[] = {0x1C, 0xF0, 0x1C};
+  static const uint8_t a1[] = {0x1E, 0x9E};
+  static const uint8_t f7_2[] = {0x83, 0xF0, 0x83};
+  static const uint8_t f7_1[] = {0x41, 0xC1};
+
+  simReset();
+
+  initPS2keyboard(&g_ps2, &recvCallback, &setPS2_SIM_Device, &PORTB, PORTB0, PORTB1);
+
+  setPS2set1Translation(&g_ps2, &set1Callback);
+
+  CHECK(translate(pause2, sizeof(pause2), pause1, sizeof(pause1)));
+  CHECK(translate(prtscrMake2, sizeof(prtscrMake2), prtscrMake1, sizeof(prtscrMake1)));
+  CHECK(translate(prtscrBreak2, sizeof(prtscrBreak2), prtscrBreak1, sizeof(prtscrBreak1)));
+  CHECK(translate(upBreak2, sizeof(upBreak2), upBreak1, sizeof(upBreak1)));
+  CHECK(translate(a2, sizeof(a2), a1, sizeof(a1)));
+  CHECK(translate(f7_2, sizeof(f7_2), f7_1, sizeof(f7_1)));
+
+  //a break pending when the keyboard is plugged back in is dropped.
+  translatePS2set1(&g_ps2, 0xF0);
+  resetPS2decoder(&g_ps2);
+
+  CHECK(translate(a2, 1, a1, 1));
+
+  //disabled translation produces nothing.
+  setPS2set1Translation(&g_ps2, NULL);
+
+  CHECK(translate(a2, sizeof(a2), a1, 0));
+
+  free(g_ps2.p_device);
+}
+
+static void testThroughput(void)
+{
+  static const uint8_t typed[] = {0x1C, 0xF0, 0x1C, 0xE0, 0x75, 0xE0, 0xF0, 0x75, 0x29, 0xF0, 0x29};
+
+  uint32_t index = 0;
+  clock_t start = 0;
+  double seconds = 0;
+
+  simReset();
+
+  initPS2keyboard(&g_ps2, &recvCallback, &setPS2_SIM_Device, &PORTB, PORTB0, PORTB1);
+
+  setPS2set1Translation(&g_ps2, &set1CountCallback);
+
+  //translation stage alone.
+  g_set1Total = 0;
+  start = clock();
+
+  for(index = 0; index < THROUGHPUT_BYTES; index++) translatePS2set1(&g_ps2, typed[index % sizeof(typed)]);
+
+  seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+  printf("  translate only: %lu bytes in %.3f s, %.1f Mbyte/s\n", THROUGHPUT_BYTES, seconds, THROUGHPUT_BYTES / seconds / 1e6);
+
+  CHECK(g_set1Total > 0);
+
+  //full receive path, translation plus decoding.
+  g_set1Total = 0;
+  start = clock();
+
+  for(index = 0; index < THROUGHPUT_BYTES; index++) extractData(&g_ps2, simFrame(typed[index % sizeof(typed)], 0));
+
+  seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+  printf("  extractData with translation: %lu bytes in %.3f s, %.1f Mbyte/s\n", THROUGHPUT_BYTES, seconds, THROUGHPUT_BYTES / seconds / 1e6);
+
+  CHECK(g_set1Total > 0);
+
+  free(g_ps2.p_device);
+}
+
+int main(void)
+{
+  printf("set 1 sequences\n");
+  testSequences();
+  printf("set 1 throughput\n");
+  testThroughput();
+
+  printf("%d checks, %d failures\n", g_checks, g_failures);
+
+  return (g_failures ? EXIT_FAILURE : EXIT_SUCCESS);
+}